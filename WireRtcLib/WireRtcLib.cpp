@@ -40,6 +40,8 @@
  */
 
 #include <avr/io.h>
+#include <util/atomic.h>
+#include <stddef.h>
 
 #define TRUE 1
 #define FALSE 0
@@ -48,6 +50,7 @@
 
 #define RTC_ADDR 0x68 // I2C address
 #define CH_BIT 7 // clock halt bit
+#define TEMP_POLL_MS 50 // between reads of a running temperature conversion
 
 // *16
 // >>4
@@ -61,36 +64,128 @@ uint8_t WireRtcLib::bcd2dec(uint8_t b)
   return ((b/16 * 10) + (b % 16));
 }
 
-uint8_t WireRtcLib::read_byte(uint8_t offset)
+#ifdef WIRERTC_WIRE_TRANSPORT
+// Largest register block moved in a single bus transaction: reads are limited
+// by the Wire receive buffer, writes also have to carry the register pointer
+#define RTC_READ_BURST  BUFFER_LENGTH
+#define RTC_WRITE_BURST (BUFFER_LENGTH - 1)
+
+uint8_t WireTransport::read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len)
 {
-	Wire.beginTransmission(RTC_ADDR);
-	Wire.write(offset);
-	Wire.endTransmission();
+	uint8_t done = 0;
 
-	Wire.requestFrom(RTC_ADDR, 1);
-	
-	if (Wire.available()) return Wire.read();
-	return 0;
+	while (done < len) {
+		uint8_t n = len - done > RTC_READ_BURST ? RTC_READ_BURST : len - done;
+
+		// set the register pointer without releasing the bus: the read that
+		// follows is issued with a repeated START
+		Wire.beginTransmission(address);
+		Wire.write((uint8_t)(reg + done));
+		Wire.endTransmission(false);
+		Wire.requestFrom(address, n);
+
+		for (uint8_t i = 0; i < n; i++) {
+			if (!Wire.available()) return done;
+			buf[done++] = Wire.read();
+		}
+	}
+
+	return done;
 }
 
-void WireRtcLib::write_byte(uint8_t b, uint8_t offset)
+uint8_t WireTransport::write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len)
 {
-	Wire.beginTransmission(RTC_ADDR);
-	Wire.write(offset);
-	Wire.write(b);
-	Wire.endTransmission();
+	uint8_t ret = 0;
+
+	while (len) {
+		uint8_t n = len > RTC_WRITE_BURST ? RTC_WRITE_BURST : len;
+
+		Wire.beginTransmission(address);
+		Wire.write(reg);
+		Wire.write(buf, n);
+		if (Wire.endTransmission() != 0) ret = 2;
+
+		reg += n;
+		buf += n;
+		len -= n;
+	}
+
+	return ret;
 }
+#endif
 
-void WireRtcLib::write_addr(uint8_t addr)
+void WireRtcLib::readBlock(uint8_t reg, uint8_t* buf, uint8_t len)
 {
-	Wire.beginTransmission(RTC_ADDR);
-	Wire.write(addr);
-	Wire.endTransmission();
+	uint8_t n = WIRERTC_TRANSPORT::read(RTC_ADDR, reg, buf, len);
+	timeSeen(reg, buf, n);
+
+	// bytes the chip didn't deliver read as 0
+	while (n < len)
+		buf[n++] = 0;
+}
+
+void WireRtcLib::writeBlock(uint8_t reg, uint8_t* buf, uint8_t len)
+{
+	WIRERTC_TRANSPORT::write(RTC_ADDR, reg, buf, len);
+	timeSeen(reg, buf, len);
+	if (m_alarm_written) (this->*m_alarm_written)(reg, buf, len);
+}
+
+// keep the image of the time registers up to date
+void WireRtcLib::timeSeen(uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	for (; len && reg < 7; reg++, buf++, len--) {
+		m_time_image[reg] = *buf;
+		m_time_known |= 1 << reg;
+	}
+}
+
+uint8_t WireRtcLib::read_byte(uint8_t offset)
+{
+	uint8_t b;
+	readBlock(offset, &b, 1);
+	return b;
+}
+
+void WireRtcLib::write_byte(uint8_t b, uint8_t offset)
+{
+	writeBlock(offset, &b, 1);
 }
 
 WireRtcLib::WireRtcLib()
 : m_is_ds1307(false)
 , m_is_ds3231(false)
+, m_control(0)
+, m_status(0)
+, m_aging(0)
+, m_dirty(0)
+, m_update_depth(0)
+, m_time_known(0)
+, m_soft_clock(false)
+, m_soft_edge(false)
+, m_soft_valid(false)
+, m_soft_ticks(0)
+, m_soft_resync(0)
+, m_alarm_int(false)
+, m_alarm_fired(false)
+, m_alarm_handler(0)
+, m_temp_state(TEMP_IDLE)
+, m_temp_polled(0)
+, m_temp()
+, m_temp_callback(0)
+, m_alarm_cached(false)
+, m_alarm_secs(0)
+, m_alarm_mode(ALARM_DAILY)
+, m_alarm_day(0)
+, m_alarm_mon(1)
+, m_alarm_year(0)
+, m_alarm_period(SECS_PER_DAY)
+, m_alarm_armed(false)
+, m_alarm_left(0)
+, m_alarm_last(0)
+, m_alarm_ticks(0)
+, m_alarm_written(0)
+, m_alarm_tick(0)
 {}
 
 void WireRtcLib::begin()
@@ -109,14 +204,16 @@ void WireRtcLib::begin()
 	write_byte(0xdd, 0x12);
 	
 	if (read_byte(0x11) == 0xee && read_byte(0x12) == 0xdd) {
-		m_is_ds1307 = true;
+		setChip(true);
 		// restore values
 		write_byte(temp1, 0x11);
 		write_byte(temp2, 0x12);
 	}
 	else {
-		m_is_ds3231 = true;
+		setChip(false);
 	}
+
+	reloadShadow();
 }
 
 // Autodetection
@@ -124,107 +221,532 @@ bool WireRtcLib::isDS1307(void) { return m_is_ds1307; }
 bool WireRtcLib::isDS3231(void) { return m_is_ds3231; }
 
 // Autodetection override
-void WireRtcLib::setDS1307(void) { m_is_ds1307 = true;   m_is_ds3231 = false; }
-void WireRtcLib::setDS3231(void) { m_is_ds1307 = false;  m_is_ds3231 = true;  }
+void WireRtcLib::setDS1307(void) { setChip(true);  reloadShadow(); }
+void WireRtcLib::setDS3231(void) { setChip(false); reloadShadow(); }
+
+// set the chip type without touching the bus
+void WireRtcLib::setChip(bool is_ds1307)
+{
+	m_is_ds1307 = is_ds1307;
+	m_is_ds3231 = !is_ds1307;
+
+	if (!is_ds1307) {
+		// the DS1307 alarm engine starts over if it is used again
+		m_alarm_written = 0;
+		m_alarm_tick = 0;
+		m_alarm_cached = false;
+		m_alarm_armed = false;
+	}
+}
+
+// CONTROL REGISTER SHADOW
+//
+// DS1307: control (0x07)
+// DS3231: control (0x0E), control/status (0x0F) and aging offset (0x10)
+// Configuration changes are made in RAM and written back by flushShadow,
+// in one burst from the first DS3231 register that changed to the last
+//
+#define SHADOW_CONTROL 0b00000001
+#define SHADOW_STATUS  0b00000010
+#define SHADOW_AGING   0b00000100
+
+// DS3231 status bits that are cleared by writing 0 and left alone by writing 1:
+// OSF, A2F, A1F. The shadow keeps them at 1 so a write-back never clears them
+#define DS3231_STATUS_FLAGS 0b10000011
+
+void WireRtcLib::reloadShadow(void)
+{
+	if (m_is_ds1307) reloadShadow1307();
+	else             reloadShadow3231();
+}
+
+void WireRtcLib::reloadShadow1307(void)
+{
+	m_control = read_byte(0x07);
+	m_dirty = 0;
+}
+
+void WireRtcLib::reloadShadow3231(void)
+{
+	uint8_t regs[3];
+	readBlock(0x0E, regs, 3);
+	m_control = regs[0] & ~0b00100000; // CONV is cleared by the chip
+	m_status  = regs[1] | DS3231_STATUS_FLAGS;
+	m_aging   = regs[2];
+	m_dirty = 0;
+}
+
+void WireRtcLib::flushShadow(void)
+{
+	if (m_is_ds1307) flushShadow1307();
+	else             flushShadow3231();
+}
+
+void WireRtcLib::flushShadow1307(void)
+{
+	if (m_update_depth || !m_dirty) return;
+
+	write_byte(m_control, 0x07);
+	m_dirty = 0;
+}
+
+void WireRtcLib::flushShadow3231(void)
+{
+	if (m_update_depth || !m_dirty) return;
+
+	// registers in between that didn't change are written as they are
+	uint8_t regs[3] = { m_control, m_status, (uint8_t)m_aging };
+	uint8_t first = (m_dirty & SHADOW_CONTROL) ? 0 : (m_dirty & SHADOW_STATUS) ? 1 : 2;
+	uint8_t last  = (m_dirty & SHADOW_AGING)   ? 2 : (m_dirty & SHADOW_STATUS) ? 1 : 0;
+	writeBlock(0x0E + first, regs + first, last - first + 1);
+
+	m_dirty = 0;
+}
+
+void WireRtcLib::beginUpdate(void)
+{
+	m_update_depth++;
+}
+
+void WireRtcLib::endUpdate(void)
+{
+	leaveUpdate();
+	flushShadow();
+}
+
+void WireRtcLib::leaveUpdate(void)
+{
+	if (m_update_depth) m_update_depth--;
+}
+
+void WireRtcLib::update12h(WireRtcLib::tm* t)
+{
+	if (t->hour == 0) {
+		t->twelveHour = 0;
+		t->am = 1;
+	}
+	else if (t->hour < 12) {
+		t->twelveHour = t->hour;
+		t->am = 1;
+	}
+	else {
+		t->twelveHour = t->hour - 12;
+		t->am = 0;
+	}
+}
+
+// Packed BCD decode of four register bytes at once. A BCD byte 16*h + l is
+// 10*h + l == b - 6*h, and since b >= 6*h no lane ever borrows from the next.
+static inline uint32_t bcd2dec_4(uint32_t b)
+{
+	return b - 6 * ((b >> 4) & 0x0F0F0F0FUL);
+}
+
+// Register bits that are not part of the value: CH (sec), 12/24 (hour) and
+// century (month) are cleared in the same pass as the decode
+#define TIME_MASK_LO 0x073F7F7FUL // wday, hour, min, sec
+#define TIME_MASK_HI 0x00FF1F3FUL // -, year, month, mday
+
+static inline uint32_t load_4(const uint8_t* p)
+{
+	return p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// decode the 7 time registers into m_tm
+void WireRtcLib::decodeTime(const uint8_t* rtc)
+{
+	// only 7 registers: the fourth byte of the high word stays zero
+	uint32_t hi = rtc[4] | ((uint16_t)rtc[5] << 8) | ((uint32_t)rtc[6] << 16);
+	uint32_t lo = bcd2dec_4(load_4(rtc) & TIME_MASK_LO);
+
+	hi = bcd2dec_4(hi & TIME_MASK_HI);
+
+	m_tm.sec  = lo;
+	m_tm.min  = lo >> 8;
+	m_tm.hour = lo >> 16;
+	m_tm.wday = lo >> 24; // returns 1-7
+	m_tm.mday = hi;
+	m_tm.mon  = hi >> 8;  // returns 1-12
+	m_tm.year = hi >> 16; // year 0-99
+
+	update12h(&m_tm);
+}
+
+// SOFTWARE CLOCK
+//
+// A copy of the time in RAM is advanced on every falling edge of the 1Hz
+// square wave (DS1307 SQW/OUT, DS3231 INT/SQW), which is when the chip
+// updates its seconds register. getTime and getTime_s serve the copy and
+// only go to the bus to resync.
+//
+WireRtcLib* WireRtcLib::s_instance = 0;
+
+static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; // january is month 0
+
+void WireRtcLib::isr(void)
+{
+	if (s_instance) s_instance->handleInterrupt();
+}
+
+void WireRtcLib::handleInterrupt(void)
+{
+	if (m_is_ds1307) {
+		// the square wave drives both
+		if (m_alarm_int && m_alarm_tick) (this->*m_alarm_tick)();
+	}
+	else if (m_alarm_int) {
+		// A1F is cleared by checkAlarm: Wire can't be used from here
+		m_alarm_fired = true;
+		if (m_alarm_handler) m_alarm_handler();
+		return;
+	}
+
+	if (!m_soft_clock) return;
+
+	tm* t = &m_soft_tm;
+	uint8_t mdays;
+
+	m_soft_edge = true;
+	if (m_soft_ticks != 0xFFFF) m_soft_ticks++;
+
+	if (++t->sec < 60) return;
+	t->sec = 0;
+	if (++t->min < 60) return;
+	t->min = 0;
+	if (++t->hour < 24) return;
+	t->hour = 0;
+	if (++t->wday > 7) t->wday = 1;
+
+	mdays = monthDays[t->mon - 1];
+	if (t->mon == 2 && (t->year & 3) == 0) mdays = 29; // year is 2000-2099
+	if (++t->mday <= mdays) return;
+	t->mday = 1;
+	if (++t->mon <= 12) return;
+	t->mon = 1;
+	t->year++;
+}
+
+// Read the time from the chip into the software clock. A read that was
+// overlapped by an edge may or may not include it, so it is repeated.
+void WireRtcLib::softSync(void)
+{
+	uint8_t rtc[7];
+	bool synced = false;
+
+	while (!synced) {
+		m_soft_edge = false;
+		readBlock(0, rtc, 7);
+		decodeTime(rtc);
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (!m_soft_edge) {
+				m_soft_tm = m_tm;
+				m_soft_ticks = 0;
+				synced = true;
+			}
+		}
+	}
+
+	m_soft_valid = true;
+}
+
+// true when the software clock can be served without going to the bus
+bool WireRtcLib::softCurrent(void)
+{
+	if (!m_soft_clock) return false;
+
+	// the time now comes from RAM, not the registers: adjustTime mustn't
+	// diff against what they held when last read (a resync below refills it)
+	m_time_known = 0;
+
+	if (!m_soft_valid || (m_soft_resync && m_soft_ticks >= m_soft_resync))
+		softSync();
+
+	return true;
+}
+
+void WireRtcLib::enableSoftClock(uint8_t pin, uint16_t resyncInterval)
+{
+	// 1Hz square wave, in one control register write
+	beginUpdate();
+	SQWSetFreq(FREQ_1);
+	SQWEnable(true);
+	endUpdate();
+
+	startSoftClock(pin, resyncInterval);
+}
+
+// the square wave is already running
+void WireRtcLib::startSoftClock(uint8_t pin, uint16_t resyncInterval)
+{
+	m_soft_resync = resyncInterval;
+	m_soft_clock = true;
+	// on the DS3231 the square wave takes over INT/SQW
+	if (m_is_ds3231) m_alarm_int = false;
+	attachPin(pin);
+	softSync();
+}
+
+void WireRtcLib::attachPin(uint8_t pin)
+{
+	if (pin == NO_PIN) return;
+
+	// the RTC output is open drain
+	s_instance = this;
+	pinMode(pin, INPUT_PULLUP);
+	attachInterrupt(digitalPinToInterrupt(pin), isr, FALLING);
+}
+
+void WireRtcLib::disableSoftClock(void)
+{
+	m_soft_clock = false;
+	m_soft_valid = false;
+}
 
 WireRtcLib::tm* WireRtcLib::getTime(void)
 {
 	uint8_t rtc[9];
 
+	if (softCurrent()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			m_tm = m_soft_tm;
+		}
+		update12h(&m_tm);
+		return &m_tm;
+	}
+
 	// read 7 bytes starting from register 0
 	// sec, min, hour, day-of-week, date, month, year
-	write_addr(0); // wake up the RTC
+	readBlock(0, rtc, 7);
+	decodeTime(rtc);
 	
-	Wire.requestFrom(RTC_ADDR, 7);
-	
-	for(uint8_t i=0; i<7; i++) {
-		if (Wire.available())
-			rtc[i] = Wire.read();
-		else
-			break;
+	return &m_tm;
+}
+
+void WireRtcLib::getTime_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
+{
+	uint8_t rtc[9];
+	uint32_t t;
+
+	if (softCurrent()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (sec)  *sec  = m_soft_tm.sec;
+			if (min)  *min  = m_soft_tm.min;
+			if (hour) *hour = m_soft_tm.hour;
+		}
+		return;
 	}
-	
-	Wire.endTransmission();
-
-	// Clear clock halt bit from read data
-	rtc[0] &= ~(_BV(CH_BIT)); // clear bit
-
-	m_tm.sec  = bcd2dec(rtc[0]);
-	m_tm.min  = bcd2dec(rtc[1]);
-	m_tm.hour = bcd2dec(rtc[2]);
-	m_tm.mday = bcd2dec(rtc[4]);
-	m_tm.mon  = bcd2dec(rtc[5]); // returns 1-12
-	m_tm.year = bcd2dec(rtc[6]); // year 0-99
-	m_tm.wday = bcd2dec(rtc[3]); // returns 1-7
-	
-	if (m_tm.hour == 0) {
-		m_tm.twelveHour = 0;
-		m_tm.am = 1;
+
+	// read 3 bytes starting from register 0: sec, min, hour
+	readBlock(0, rtc, 3);
+	rtc[3] = 0;
+	t = bcd2dec_4(load_4(rtc) & TIME_MASK_LO);
+
+	if (sec)  *sec =  t;
+	if (min)  *min =  t >> 8;
+	if (hour) *hour = t >> 16;
+}
+
+// field bit n is time register n
+static const uint8_t s_field_offsets[7] = {
+	offsetof(WireRtcLib::tm, sec), offsetof(WireRtcLib::tm, min), offsetof(WireRtcLib::tm, hour),
+	offsetof(WireRtcLib::tm, wday), offsetof(WireRtcLib::tm, mday), offsetof(WireRtcLib::tm, mon),
+	offsetof(WireRtcLib::tm, year)
+};
+// value bits of each register, as TIME_MASK_LO and TIME_MASK_HI
+static const uint8_t s_field_masks[7] = { 0x7F, 0x7F, 0x3F, 0x07, 0x3F, 0x1F, 0xFF };
+
+#define TM_FIELD(t, i) (*((uint8_t*)(t) + s_field_offsets[i]))
+
+WireRtcLib::tm* WireRtcLib::getFields(uint8_t mask)
+{
+	uint8_t rtc[7];
+	uint8_t fields = mask & FIELD_ALL;
+	uint8_t first, last, i;
+
+	if (mask & FIELD_12H) fields |= FIELD_HOUR;
+
+	if (softCurrent()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			for (i = 0; i < 7; i++)
+				if (fields & (1 << i)) TM_FIELD(&m_tm, i) = TM_FIELD(&m_soft_tm, i);
+		}
+	}
+	else if (fields) {
+		for (first = 0; !(fields & (1 << first)); first++);
+		for (last = 6; !(fields & (1 << last)); last--);
+		readBlock(first, rtc + first, last - first + 1);
+
+		for (i = first; i <= last; i++)
+			if (fields & (1 << i)) TM_FIELD(&m_tm, i) = bcd2dec(rtc[i] & s_field_masks[i]);
 	}
-	else if (m_tm.hour < 12) {
-		m_tm.twelveHour = m_tm.hour;
-		m_tm.am = 1;
+
+	if (mask & FIELD_12H) update12h(&m_tm);
+	return &m_tm;
+}
+
+// The chip copies the time registers to a buffer on the START of each read,
+// so one burst always has a time and date that belong together. Other
+// registers (alarm flags, BSY) are read live, so the seconds are read once
+// more afterwards: if they moved on, the time rolled over in between and
+// everything is read again. Registers up to SNAPSHOT_BURST go in the same
+// burst as the time, others in a read of their own.
+#define SNAPSHOT_BURST 16 // through the DS3231 status register
+
+WireRtcLib::tm* WireRtcLib::getSnapshot(uint8_t reg, uint8_t* buf, uint8_t len)
+{
+	uint8_t rtc[SNAPSHOT_BURST];
+	uint8_t end = reg + len;
+
+	do {
+		if (end <= SNAPSHOT_BURST) {
+			readBlock(0, rtc, end > 7 ? end : 7);
+			for (uint8_t i = 0; i < len; i++)
+				buf[i] = rtc[reg + i];
+		}
+		else {
+			readBlock(0, rtc, 7);
+			readBlock(reg, buf, len);
+		}
+	} while (end > 7 && read_byte(0) != rtc[0]);
+
+	decodeTime(rtc);
+	return &m_tm;
+}
+
+// The year register is taken as 2000-2099, with every fourth year a leap
+// year from 2000 on. Days are counted from 2000-01-01, a Saturday.
+static const uint16_t s_days_before_month[] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static time_t epoch(uint8_t year, uint8_t mon, uint8_t mday, uint8_t hour, uint8_t min, uint8_t sec)
+{
+	if (mon < 1 || mon > 12) mon = 1;
+	uint16_t days = 365 * year + (year + 3) / 4 + s_days_before_month[mon - 1] + mday - 1;
+	if (mon > 2 && (year & 3) == 0) days++;
+
+	return SECS_YR_2000 + days * SECS_PER_DAY + hour * SECS_PER_HOUR + min * SECS_PER_MIN + sec;
+}
+
+time_t WireRtcLib::getEpoch(void)
+{
+	uint8_t rtc[8];
+	uint32_t lo, hi;
+
+	if (softCurrent()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			lo = m_soft_tm.sec | ((uint16_t)m_soft_tm.min << 8) | ((uint32_t)m_soft_tm.hour << 16);
+			hi = m_soft_tm.mday | ((uint16_t)m_soft_tm.mon << 8) | ((uint32_t)m_soft_tm.year << 16);
+		}
 	}
 	else {
-		m_tm.twelveHour = m_tm.hour - 12;
-		m_tm.am = 0;
+		// both words decoded at once, straight from the registers
+		readBlock(0, rtc, 7);
+		rtc[7] = 0;
+		lo = bcd2dec_4(load_4(rtc) & TIME_MASK_LO);
+		hi = bcd2dec_4(load_4(rtc + 4) & TIME_MASK_HI);
 	}
-	
-	return &m_tm;
+
+	return epoch(hi >> 16, hi >> 8, hi, lo >> 16, lo >> 8, lo);
 }
 
-void WireRtcLib::getTime_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
+void WireRtcLib::setEpoch(time_t t)
 {
-	uint8_t rtc[9];
+	uint8_t rtc[7];
 
-	// read 7 bytes starting from register 0
-	// sec, min, hour, day-of-week, date, month, year
-	write_addr(0); // wake up the RTC
-	
-	Wire.requestFrom(RTC_ADDR, 7);
-	
-	for(uint8_t i=0; i<7; i++) {
-		if (Wire.available())
-			rtc[i] = Wire.read();
-		else
-			break;
+	// the registers hold 2000-01-01 to 2099-12-31
+	if (t < SECS_YR_2000) t = SECS_YR_2000;
+	if (t > SECS_YR_2100 - 1) t = SECS_YR_2100 - 1;
+	t -= SECS_YR_2000;
+	uint16_t days = t / SECS_PER_DAY;
+	uint32_t secs = t % SECS_PER_DAY;
+
+	// four year blocks of 1461 days, each starting with a leap year
+	uint8_t year = days / 1461 * 4;
+	uint16_t doy = days % 1461;
+	bool leap = doy < 366;
+	if (!leap) {
+		year += 1 + (doy - 366) / 365;
+		doy = (doy - 366) % 365;
 	}
-	
-	Wire.endTransmission();
-	
-	if (sec)  *sec =  bcd2dec(rtc[0]);
-	if (min)  *min =  bcd2dec(rtc[1]);
-	if (hour) *hour = bcd2dec(rtc[2]);
+	uint8_t mon;
+	for (mon = 11; doy < s_days_before_month[mon] + (leap && mon >= 2); mon--);
+	doy -= s_days_before_month[mon] + (leap && mon >= 2);
+
+	// clock halt bit is 7th bit of seconds: this is always cleared to start the clock
+	rtc[0] = dec2bcd(secs % 60);
+	rtc[1] = dec2bcd(secs / 60 % 60);
+	rtc[2] = dec2bcd(secs / 3600);
+	rtc[3] = (days + 6) % 7 + 1; // Sunday is 1
+	rtc[4] = dec2bcd(doy + 1);
+	rtc[5] = dec2bcd(mon + 1);
+	rtc[6] = dec2bcd(year);
+
+	writeBlock(0, rtc, 7);
+
+	// the software clock picks the new time up on its next read
+	m_soft_valid = false;
 }
 
 void WireRtcLib::setTime(WireRtcLib::tm* tm)
 {
-	Wire.beginTransmission(RTC_ADDR);
-	Wire.write((uint8_t)0);
+	uint8_t rtc[7];
 
 	// clock halt bit is 7th bit of seconds: this is always cleared to start the clock
-	Wire.write(dec2bcd(tm->sec)); // seconds
-	Wire.write(dec2bcd(tm->min)); // minutes
-	Wire.write(dec2bcd(tm->hour)); // hours
-	Wire.write(dec2bcd(tm->wday)); // day of week
-	Wire.write(dec2bcd(tm->mday)); // day
-	Wire.write(dec2bcd(tm->mon)); // month
-	Wire.write(dec2bcd(tm->year)); // year
+	rtc[0] = dec2bcd(tm->sec); // seconds
+	rtc[1] = dec2bcd(tm->min); // minutes
+	rtc[2] = dec2bcd(tm->hour); // hours
+	rtc[3] = dec2bcd(tm->wday); // day of week
+	rtc[4] = dec2bcd(tm->mday); // day
+	rtc[5] = dec2bcd(tm->mon); // month
+	rtc[6] = dec2bcd(tm->year); // year
 	
-	Wire.endTransmission();
+	writeBlock(0, rtc, 7);
+
+	// the software clock picks the new time up on its next read
+	m_soft_valid = false;
+}
+
+void WireRtcLib::adjustTime(WireRtcLib::tm* tm)
+{
+	uint8_t rtc[7];
+	uint8_t first, last;
+
+	rtc[0] = dec2bcd(tm->sec);
+	rtc[1] = dec2bcd(tm->min);
+	rtc[2] = dec2bcd(tm->hour);
+	rtc[3] = dec2bcd(tm->wday);
+	rtc[4] = dec2bcd(tm->mday);
+	rtc[5] = dec2bcd(tm->mon);
+	rtc[6] = dec2bcd(tm->year);
+
+	// CH and the century bit as the chip has them
+	if (m_time_known & (1 << 0)) rtc[0] |= m_time_image[0] & 0x80;
+	if (m_time_known & (1 << 5)) rtc[5] |= m_time_image[5] & 0x80;
+
+	// the registers that differ from the image, or aren't in it
+	for (first = 0; first < 7 && (m_time_known & (1 << first)) && rtc[first] == m_time_image[first]; first++);
+	if (first == 7) return;
+	for (last = 6; (m_time_known & (1 << last)) && rtc[last] == m_time_image[last]; last--);
+
+	writeBlock(first, rtc + first, last - first + 1);
+
+	// the software clock picks the new time up on its next read
+	m_soft_valid = false;
 }
 
 void WireRtcLib::setTime_s(uint8_t hour, uint8_t min, uint8_t sec)
 {
-	Wire.beginTransmission(RTC_ADDR);
-	Wire.write((uint8_t)0);
+	uint8_t rtc[3];
 
 	// clock halt bit is 7th bit of seconds: this is always cleared to start the clock
-	Wire.write(dec2bcd(sec)); // seconds
-	Wire.write(dec2bcd(min)); // minutes
-	Wire.write(dec2bcd(hour)); // hours
+	rtc[0] = dec2bcd(sec); // seconds
+	rtc[1] = dec2bcd(min); // minutes
+	rtc[2] = dec2bcd(hour); // hours
 	
-	Wire.endTransmission();
+	writeBlock(0, rtc, 3);
+
+	// the software clock picks the new time up on its next read
+	m_soft_valid = false;
 }
 
 // halt/start the clock
@@ -233,8 +755,11 @@ void WireRtcLib::setTime_s(uint8_t hour, uint8_t min, uint8_t sec)
 // 1 = clock is not running
 void WireRtcLib::runClock(bool run)
 {
-  if (m_is_ds3231) return;
-  
+  if (!m_is_ds3231) runClock1307(run);
+}
+
+void WireRtcLib::runClock1307(bool run)
+{
   uint8_t b = read_byte(0x0);
 
   if (run)
@@ -248,7 +773,11 @@ void WireRtcLib::runClock(bool run)
 bool WireRtcLib::isClockRunning(void)
 {
   if (m_is_ds3231) return true;
-  
+  return isClockRunning1307();
+}
+
+bool WireRtcLib::isClockRunning1307(void)
+{
   uint8_t b = read_byte(0x0);
 
   if (b & _BV(CH_BIT)) return false;
@@ -257,51 +786,111 @@ bool WireRtcLib::isClockRunning(void)
 
 void WireRtcLib::getTemp(int8_t* i, uint8_t* f)
 {
-	uint8_t msb, lsb;
-	
-	*i = 0;
-	*f = 0;
-	
-	if (m_is_ds1307) return; // only valid on DS3231
+	if (m_is_ds1307) { // only valid on DS3231
+		*i = 0;
+		*f = 0;
+		return;
+	}
+	getTemp3231(i, f);
+}
+
+// temp registers are 0x11 and 0x12
+static void decodeTemp(const uint8_t* temp, int8_t* i, uint8_t* f)
+{
+	// integer part in entire byte (in twos complement)
+	*i = temp[0];
+	// fractional part in top two bits (increments of 0.25)
+	*f = (temp[1] >> 6) * 25;
 	
-	// temp registers are 0x11 and 0x12
-	write_addr(0x11);
+	// float value can be read like so:
+	// float temp = ((((short)msb << 8) | (short)lsb) >> 6) / 4.0f;
+}
 
-	Wire.requestFrom(RTC_ADDR, 2);
+void WireRtcLib::getTemp3231(int8_t* i, uint8_t* f)
+{
+	uint8_t temp[2];
 
-	if (Wire.available() >= 2) {
-		msb = Wire.read(); // integer part (in twos complement)
-		lsb = Wire.read(); // fraction part
-		
-		// integer part in entire byte
-		*i = msb;
-		// fractional part in top two bits (increments of 0.25)
-		*f = (lsb >> 6) * 25;
-		
-		// float value can be read like so:
-		// float temp = ((((short)msb << 8) | (short)lsb) >> 6) / 4.0f;
-	}
+	readBlock(0x11, temp, 2);
+	decodeTemp(temp, i, f);
 }
 
 void WireRtcLib::forceTempConversion(uint8_t block)
 {
-	if (m_is_ds1307) return; // only valid on DS3231
-
-	// read control register (0x0E)
-	uint8_t control = read_byte(0x0E);  // read control register
-	control |= 0b00100000; // Set CONV bit
+	if (!m_is_ds1307) forceTempConversion3231(block); // only valid on DS3231
+}
 
-	// write new control register value
-	write_byte(control, 0x0E);
+void WireRtcLib::forceTempConversion3231(uint8_t block)
+{
+	// set CONV bit on top of the shadowed control register (0x0E)
+	// the chip clears it again, so it is not kept in the shadow
+	write_byte(m_control | 0b00100000, 0x0E);
 
 	if (!block) return;
 	
 	// Temp conversion is ready when control register becomes 0
+	// Block until CONV is 0, without keeping the bus busy
 	do {
-		// Block until CONV is 0
-		write_addr(0x0E);
-		Wire.requestFrom(RTC_ADDR, 1);
-	} while (Wire.available() && (Wire.read() & 0b00100000) != 0);
+		delay(TEMP_POLL_MS);
+	} while ((read_byte(0x0E) & 0b00100000) != 0);
+}
+
+bool WireRtcLib::startTempConversion(void (*callback)(int8_t i, uint8_t f))
+{
+	if (m_is_ds1307) return false; // only valid on DS3231
+	return startTempConversion3231(callback);
+}
+
+bool WireRtcLib::startTempConversion3231(void (*callback)(int8_t i, uint8_t f))
+{
+	if (m_temp_state == TEMP_CONVERTING) return false;
+
+	// CONV, as forceTempConversion
+	write_byte(m_control | 0b00100000, 0x0E);
+
+	m_temp_callback = callback;
+	m_temp_polled = millis();
+	m_temp_state = TEMP_CONVERTING;
+	return true;
+}
+
+enum WireRtcLib::TEMP_STATE WireRtcLib::pollTempConversion(void)
+{
+	if (m_is_ds1307) return TEMP_IDLE;
+	return pollTempConversion3231();
+}
+
+enum WireRtcLib::TEMP_STATE WireRtcLib::pollTempConversion3231(void)
+{
+	uint16_t ms = millis();
+	uint8_t regs[5];
+
+	if (m_temp_state != TEMP_CONVERTING || (uint16_t)(ms - m_temp_polled) < TEMP_POLL_MS)
+		return (enum TEMP_STATE)m_temp_state;
+	m_temp_polled = ms;
+
+	// control, status, aging offset and temperature in one read, so that
+	// the poll that sees the conversion done has the result too
+	readBlock(0x0E, regs, 5);
+	if ((regs[0] & 0b00100000) || (regs[1] & 0b00000100)) // CONV, BSY
+		return TEMP_CONVERTING;
+
+	m_temp[0] = regs[3];
+	m_temp[1] = regs[4];
+	m_temp_state = TEMP_READY;
+
+	if (m_temp_callback) {
+		int8_t i;
+		uint8_t f;
+		decodeTemp(m_temp, &i, &f);
+		m_temp_callback(i, f);
+	}
+	return TEMP_READY;
+}
+
+void WireRtcLib::getTempResult(int8_t* i, uint8_t* f)
+{
+	decodeTemp(m_temp, i, f);
+	if (m_temp_state == TEMP_READY) m_temp_state = TEMP_IDLE;
 }
 
 #define DS1307_SRAM_ADDR 0x08
@@ -309,18 +898,14 @@ void WireRtcLib::forceTempConversion(uint8_t block)
 // SRAM: 56 bytes from address 0x08 to 0x3f (DS1307-only)
 void WireRtcLib::getSram(uint8_t* data)
 {
-	// cannot receive 56 bytes in one go, because of the Wire library buffer limit
-	// so just receive one at a time for simplicity
-  	for(int i=0;i<56;i++)
-		data[i] = getSramByte(i);
+	// split into as few bursts as the Wire library buffer allows
+	readBlock(DS1307_SRAM_ADDR, data, 56);
 }
 
 void WireRtcLib::setSram(uint8_t *data)
 {
-	// cannot send 56 bytes in one go, because of the Wire library buffer limit
-	// so just send one at a time for simplicity
-  	for(int i=0;i<56;i++)
-		setSramByte(data[i], i);
+	// split into as few bursts as the Wire library buffer allows
+	writeBlock(DS1307_SRAM_ADDR, data, 56);
 }
 
 uint8_t WireRtcLib::getSramByte(uint8_t offset)
@@ -335,111 +920,450 @@ void WireRtcLib::setSramByte(uint8_t b, uint8_t offset)
 
 void WireRtcLib::SQWEnable(bool enable)
 {
-	byte offset = 0x0E; // DS3231
-	if (m_is_ds1307)
-		offset = 0x07;
-	uint8_t control = read_byte(offset);  // read control register
-	if (m_is_ds1307) {
-		if (enable)
-			control |=  0b00010000; // set SQWE to 1
-		else
-			control &= ~0b00010000; // set SQWE to 0
-	}
-	else { // DS3231
-		if (enable) {
-			control |=  0b01000000; // set BBSQW to 1
-			control &= ~0b00000100; // set INTCN to 0
-		}
-		else {
-			control &= ~0b01000000; // set BBSQW to 0
-		}
-	}
-	// write control back
-	write_byte(control, offset);
+	if (m_is_ds1307) SQWEnable1307(enable);
+	else             SQWEnable3231(enable);
 }
 
-void WireRtcLib::SQWSetFreq(enum RTC_SQW_FREQ freq)
+void WireRtcLib::SQWEnable1307(bool enable)
 {
-	byte offset = 0x0E; // DS3231
-	if (m_is_ds1307)
-		offset = 0x07;
-	uint8_t control = read_byte(offset);  // read control register
-	if (m_is_ds1307) {
-		control &= ~0b00000011; // Set to 0
-		control |= freq; // Set freq bitmask
+	if (enable)
+		m_control |=  0b00010000; // set SQWE to 1
+	else
+		m_control &= ~0b00010000; // set SQWE to 0
+
+	SQWChanged1307();
+	m_dirty |= SHADOW_CONTROL;
+	flushShadow1307();
+}
+
+void WireRtcLib::SQWEnable3231(bool enable)
+{
+	if (enable) {
+		m_control |=  0b01000000; // set BBSQW to 1
+		m_control &= ~0b00000100; // set INTCN to 0
+		// INT/SQW now carries the square wave, whose edges aren't alarms
+		m_alarm_int = false;
 	}
-	else { // DS3231
-		control &= ~0b00011000; // Set to 0
-		control |= (freq << 4); // Set freq bitmask
+	else {
+		m_control &= ~0b01000000; // set BBSQW to 0
 	}
-	// write control back
-	write_byte(control, offset);
+
+	SQWChanged3231();
+	m_dirty |= SHADOW_CONTROL;
+	flushShadow3231();
+}
+
+void WireRtcLib::SQWSetFreq(enum RTC_SQW_FREQ freq)
+{
+	if (m_is_ds1307) SQWSetFreq1307(freq);
+	else             SQWSetFreq3231(freq);
+}
+
+void WireRtcLib::SQWSetFreq1307(enum RTC_SQW_FREQ freq)
+{
+	m_control &= ~0b00000011; // Set to 0
+	m_control |= freq; // Set freq bitmask
+
+	SQWChanged1307();
+	m_dirty |= SHADOW_CONTROL;
+	flushShadow1307();
+}
+
+// DS3231: RS1, RS2 in bits 3 and 4
+void WireRtcLib::SQWSetFreq3231(enum RTC_SQW_FREQ freq)
+{
+	m_control &= ~0b00011000; // Set to 0
+	m_control |= (freq << 3); // Set freq bitmask
+
+	SQWChanged3231();
+	m_dirty |= SHADOW_CONTROL;
+	flushShadow3231();
+}
+
+// The soft clock and the DS1307 alarm interrupt count the edges of the 1Hz
+// square wave: a control change that stops it or moves it off 1Hz turns
+// them off
+void WireRtcLib::SQWChanged1307(void)
+{
+	if ((m_control & 0b00010011) == 0b00010000) return; // SQWE, RS1-RS0
+
+	disableSoftClock();
+	disableAlarmInterrupt();
+}
+
+void WireRtcLib::SQWChanged3231(void)
+{
+	if ((m_control & 0b01011100) == 0b01000000) return; // BBSQW, RS2-RS1, INTCN
+
+	disableSoftClock();
 }
 
 // DS3231 only
 void WireRtcLib::Osc32kHzEnable(bool enable)
 {
-	if (!m_is_ds3231) return;
-
-	uint8_t status = read_byte(0x0F);  // read status
+	if (m_is_ds3231) Osc32kHzEnable3231(enable);
+}
 
+void WireRtcLib::Osc32kHzEnable3231(bool enable)
+{
 	if (enable)
-		status |= 0b00001000; // set to 1
+		m_status |= 0b00001000; // set to 1
 	else
-		status &= ~0b00001000; // Set to 0
+		m_status &= ~0b00001000; // Set to 0
+
+	m_dirty |= SHADOW_STATUS;
+	flushShadow3231();
+}
+
+void WireRtcLib::configure(const config& c)
+{
+	if (m_is_ds1307) configure1307(c);
+	else             configure3231(c);
+}
+
+void WireRtcLib::configure1307(const config& c)
+{
+	// OUT, SQWE, RS1-RS0
+	uint8_t control = (c.out ? 0b10000000 : 0) | (c.sqw ? 0b00010000 : 0) | (c.freq & 0b00000011);
 
-	// write status back
-	write_byte(status, 0x0F);
+	if (control != m_control) m_dirty |= SHADOW_CONTROL;
+	m_control = control;
+	SQWChanged1307();
+	flushShadow1307();
+}
+
+void WireRtcLib::configure3231(const config& c)
+{
+	// EOSC as it is; BBSQW and INTCN from sqw, RS2-RS1, A2IE, A1IE
+	uint8_t control = (m_control & 0b10000000) |
+		(c.sqw ? 0b01000000 : 0b00000100) |
+		((c.freq & 0b00000011) << 3) |
+		(c.alarmInt & 0b00000011);
+	uint8_t status = (m_status & ~0b00001000) | (c.osc32kHz ? 0b00001000 : 0);
+
+	// as SQWEnable3231
+	if (c.sqw) m_alarm_int = false;
+
+	if (control != m_control) m_dirty |= SHADOW_CONTROL;
+	if (status != m_status)   m_dirty |= SHADOW_STATUS;
+	if (c.aging != m_aging)   m_dirty |= SHADOW_AGING;
+	m_control = control;
+	m_status = status;
+	m_aging = c.aging;
+	SQWChanged3231();
+	flushShadow3231();
+}
+
+void WireRtcLib::getConfig(config* c)
+{
+	if (m_is_ds1307) getConfig1307(c);
+	else             getConfig3231(c);
+}
+
+void WireRtcLib::getConfig1307(config* c)
+{
+	c->sqw = m_control & 0b00010000;
+	c->freq = (enum RTC_SQW_FREQ)(m_control & 0b00000011);
+	c->out = m_control & 0b10000000;
+	c->alarmInt = 0;
+	c->osc32kHz = false;
+	c->aging = 0;
+}
+
+void WireRtcLib::getConfig3231(config* c)
+{
+	c->sqw = !(m_control & 0b00000100);
+	c->freq = (enum RTC_SQW_FREQ)((m_control >> 3) & 0b00000011);
+	c->out = false;
+	c->alarmInt = m_control & 0b00000011;
+	c->osc32kHz = m_status & 0b00001000;
+	c->aging = m_aging;
 }
 
 // ALARM FUNCTIONALITY
 //
-// On DS1307, SRAM bytes 0 to 2 are used to store the alarm data
+// On DS1307, SRAM bytes 0 to 4 are used to store the alarm data
 // On DS3232, native alarm 1 is used
 //
+// The DS1307 has no alarm: the SRAM alarm (hour, minute, second, mode, day)
+// is cached here. Once armed from a read of the time, a countdown to the
+// next match runs, so a match is reported exactly once even when the polls
+// miss the matching second. With the alarm interrupt it runs on the 1Hz
+// square wave and is re-armed by the first checkAlarm after ALARM_RESYNC
+// edges, otherwise it runs on the time each checkAlarm reads, which must
+// come at least once a day.
+//
+#define ALARM_RESYNC 3600
 
-// reset the alarm to 0:00
-void WireRtcLib::resetAlarm(void)
+static uint32_t secsOfDay(uint8_t hour, uint8_t min, uint8_t sec)
 {
-	if (m_is_ds1307) {
-		setSramByte(0, 0); // hour
-		setSramByte(0, 1); // minute
-		setSramByte(0, 2); // second
+	return hour * 3600UL + min * 60U + sec;
+}
+
+// time of day in registers 0 to 2: 24-hour mode only
+static uint32_t decodeSecs(const uint8_t* rtc)
+{
+	uint32_t t = bcd2dec_4((rtc[0] | ((uint16_t)rtc[1] << 8) | ((uint32_t)rtc[2] << 16)) & TIME_MASK_LO);
+	return secsOfDay(t >> 16, t >> 8, t);
+}
+
+// time registers needed to arm: the weekly and monthly alarms need the day
+// of week (register 3) or the date (registers 4 to 6)
+uint8_t WireRtcLib::alarmRegs1307(void)
+{
+	if (m_alarm_mode == ALARM_MONTHLY) return 7;
+	if (m_alarm_mode == ALARM_WEEKLY) return 4;
+	return 3;
+}
+
+// Monthly: days from date mday of m_alarm_mon to the next month that has
+// the date, which becomes m_alarm_mon
+uint16_t WireRtcLib::alarmNextMonth1307(uint8_t mday)
+{
+	uint8_t mon = m_alarm_mon, year = m_alarm_year, mdays;
+	uint16_t days = 0;
+
+	for (;;) {
+		mdays = monthDays[mon - 1];
+		if (mon == 2 && (year & 3) == 0) mdays = 29;
+		if (m_alarm_day > mday && m_alarm_day <= mdays) break;
+
+		days += mdays - mday;
+		mday = 0;
+		if (++mon > 12) {
+			mon = 1;
+			year++;
+		}
 	}
-	else {
-		// writing 0 to bit 7 of all four alarm 1 registers disables alarm
-		write_byte(0, 0x07); // second
-		write_byte(0, 0x08); // minute
-		write_byte(0, 0x09); // hour
-		write_byte(0, 0x0a); // day
+	m_alarm_mon = mon;
+	m_alarm_year = year;
+
+	return days + m_alarm_day - mday;
+}
+
+// Seconds from the time in rtc to the next match, never 0. *match is set
+// when the current second matches.
+uint32_t WireRtcLib::alarmUntil1307(const uint8_t* rtc, bool* match)
+{
+	uint32_t now = decodeSecs(rtc);
+	uint32_t alarm = m_alarm_secs;
+	uint32_t left;
+	uint8_t mday;
+
+	if (m_alarm_period) {
+		// position within the period: of the minute, hour, day or week
+		if (m_alarm_mode == ALARM_WEEKLY) {
+			now += (((rtc[3] & 0x07) ? rtc[3] & 0x07 : 1) - 1) * SECS_PER_DAY;
+			alarm += (m_alarm_day - 1) * SECS_PER_DAY;
+		}
+		now %= m_alarm_period;
+		alarm %= m_alarm_period;
+
+		left = (alarm + m_alarm_period - now) % m_alarm_period;
+		*match = !left;
+		return left ? left : m_alarm_period;
 	}
+
+	// monthly: count the days to the next month that has the date
+	mday = bcd2dec(rtc[4] & 0x3F);
+	m_alarm_mon = bcd2dec(rtc[5] & 0x1F);
+	m_alarm_year = bcd2dec(rtc[6]);
+	if (m_alarm_mon < 1 || m_alarm_mon > 12) m_alarm_mon = 1;
+
+	*match = mday == m_alarm_day && now == alarm;
+	if (mday == m_alarm_day && now < alarm) return alarm - now;
+
+	return alarmNextMonth1307(mday) * SECS_PER_DAY + alarm - now;
 }
 
-// set the alarm to hour:min:sec
-void WireRtcLib::setAlarm_s(uint8_t hour, uint8_t min, uint8_t sec)
+// the alarm as stored in SRAM
+void WireRtcLib::alarmCache1307(const uint8_t* alarm)
 {
-	if (m_is_ds1307) {
-		setSramByte(hour, 0); // hour
-		setSramByte(min,  1); // minute
-		setSramByte(sec,  2); // sec 
+	static const uint32_t periods[] = { SECS_PER_DAY, 1, 60, 3600, 7 * SECS_PER_DAY, 0 };
+
+	m_alarm_secs = secsOfDay(alarm[0], alarm[1], alarm[2]);
+	m_alarm_mode = alarm[3] <= ALARM_MONTHLY ? alarm[3] : ALARM_DAILY;
+	m_alarm_day = alarm[4];
+	if ((m_alarm_mode == ALARM_WEEKLY && (m_alarm_day < 1 || m_alarm_day > 7)) ||
+	    (m_alarm_mode == ALARM_MONTHLY && (m_alarm_day < 1 || m_alarm_day > 31)))
+		m_alarm_mode = ALARM_DAILY;
+	m_alarm_period = periods[m_alarm_mode];
+	m_alarm_cached = true;
+	m_alarm_written = &WireRtcLib::alarmWritten1307;
+}
+
+void WireRtcLib::alarmLoad1307(void)
+{
+	uint8_t alarm[5];
+
+	if (m_alarm_cached) return;
+
+	readBlock(DS1307_SRAM_ADDR, alarm, 5);
+	alarmCache1307(alarm);
+	m_alarm_armed = false;
+}
+
+// Start counting at the time in rtc. With catchUp, a match in the current
+// second fires: a poll may be the first to look at it.
+void WireRtcLib::alarmStart1307(const uint8_t* rtc, bool catchUp)
+{
+	bool match;
+	uint32_t left = alarmUntil1307(rtc, &match);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		m_alarm_left = left;
+		m_alarm_last = decodeSecs(rtc);
+		m_alarm_ticks = 0;
+		m_alarm_armed = true;
 	}
-	else {
-		/*
-		 *  07h: A1M1:0  Alarm 1 seconds
-		 *  08h: A1M2:0  Alarm 1 minutes
-		 *  09h: A1M3:0  Alarm 1 hour (bit6 is am/pm flag in 12h mode)
-		 *  0ah: A1M4:1  Alarm 1 day/date (bit6: 1 for day, 0 for date)
-		 *  Sets alarm to fire when hour, minute and second matches
-		 */
-		write_byte(dec2bcd(sec),  0x07); // second
-		write_byte(dec2bcd(min),  0x08); // minute
-		write_byte(dec2bcd(hour), 0x09); // hour
-		write_byte(0b10000001,         0x0a); // day (upper bit must be set)
 
-		// clear alarm flag
-		uint8_t val = read_byte(0x0f);
-		write_byte(val & ~0b00000001, 0x0f);
+	if (catchUp && match) m_alarm_fired = true;
+}
+
+// Start counting from the chip's time. A read that was overlapped by an
+// edge is repeated.
+void WireRtcLib::alarmArm1307(bool catchUp)
+{
+	uint8_t rtc[7];
+	uint16_t ticks;
+
+	alarmLoad1307();
+
+	do {
+		ticks = m_alarm_ticks;
+		readBlock(0, rtc, alarmRegs1307());
+	} while (ticks != m_alarm_ticks);
+
+	alarmStart1307(rtc, catchUp);
+}
+
+// A new alarm, already written to SRAM. As on the DS3231 an alarm that
+// went off before is dropped, and the current second doesn't match.
+void WireRtcLib::alarmChanged1307(const uint8_t* alarm)
+{
+	alarmCache1307(alarm);
+	m_alarm_fired = false;
+	alarmArm1307(false);
+}
+
+// a write to the time registers or the alarm bytes: count again
+void WireRtcLib::alarmWritten1307(uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	if (reg < DS1307_SRAM_ADDR + 5 && reg + len > DS1307_SRAM_ADDR) {
+		m_alarm_cached = false;
+	}
+	else if (reg == 0 && m_alarm_cached && len >= alarmRegs1307()) {
+		// the time that was just written: nothing to read. As on the
+		// DS3231, the new time itself doesn't match.
+		alarmStart1307(buf, false);
+		return;
+	}
+	else if (reg >= 0x07) {
+		return;
+	}
+
+	m_alarm_armed = false;
+	if (m_alarm_int) alarmArm1307(true);
+}
+
+// runs from the interrupt, on each square wave edge
+void WireRtcLib::alarmTick1307(void)
+{
+	if (m_alarm_ticks != 0xFFFF) m_alarm_ticks++;
+
+	if (!m_alarm_armed || --m_alarm_left) return;
+
+	m_alarm_left = m_alarm_period;
+	if (!m_alarm_left) {
+		// monthly: this is the date, on to the next month that has it
+		m_alarm_left = alarmNextMonth1307(m_alarm_day) * SECS_PER_DAY;
 	}
+	m_alarm_fired = true;
+	if (m_alarm_handler) m_alarm_handler();
+}
+
+
+// reset the alarm to 0:00
+void WireRtcLib::resetAlarm(void)
+{
+	if (m_is_ds1307) resetAlarm1307();
+	else             resetAlarm3231();
+}
+
+void WireRtcLib::resetAlarm1307(void)
+{
+	uint8_t alarm[5] = { 0, 0, 0, 0, 0 };
+
+	// hour, minute, second, mode (daily), day
+	WIRERTC_TRANSPORT::write(RTC_ADDR, DS1307_SRAM_ADDR, alarm, 5);
+	alarmChanged1307(alarm);
+}
+
+void WireRtcLib::resetAlarm3231(void)
+{
+	uint8_t alarm[4] = { 0, 0, 0, 0 };
+
+	// writing 0 to bit 7 of all four alarm 1 registers disables alarm
+	// second, minute, hour, day
+	writeBlock(0x07, alarm, 4);
+}
+
+// set the alarm to hour:min:sec
+void WireRtcLib::setAlarm_s(uint8_t hour, uint8_t min, uint8_t sec)
+{
+	setAlarmMode(ALARM_DAILY, 0, hour, min, sec);
+}
+
+void WireRtcLib::setAlarmMode(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+	if (m_is_ds1307) setAlarmMode1307(mode, day, hour, min, sec);
+	else             setAlarmMode3231(mode, day, hour, min, sec);
+}
+
+// the arguments setAlarmMode accepts
+static bool alarmValid(uint8_t mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+	if (hour > 23 || min > 59 || sec > 59) return false;
+	if (mode > WireRtcLib::ALARM_MONTHLY) return false;
+	if (mode == WireRtcLib::ALARM_WEEKLY && (day < 1 || day > 7)) return false;
+	if (mode == WireRtcLib::ALARM_MONTHLY && (day < 1 || day > 31)) return false;
+	return true;
+}
+
+void WireRtcLib::setAlarmMode1307(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+	if (!alarmValid(mode, day, hour, min, sec)) return;
+
+	uint8_t alarm[5] = { hour, min, sec, (uint8_t)mode, day };
+	WIRERTC_TRANSPORT::write(RTC_ADDR, DS1307_SRAM_ADDR, alarm, 5);
+	alarmChanged1307(alarm);
+}
+
+void WireRtcLib::setAlarmMode3231(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+	// A1M4-A1M1 for each mode
+	static const uint8_t masks[] = { 0b1000, 0b1111, 0b1110, 0b1100, 0b0000, 0b0000 };
+
+	if (!alarmValid(mode, day, hour, min, sec)) return;
+
+	/*
+	 *  07h: A1M1  Alarm 1 seconds
+	 *  08h: A1M2  Alarm 1 minutes
+	 *  09h: A1M3  Alarm 1 hour (bit6 is am/pm flag in 12h mode)
+	 *  0ah: A1M4  Alarm 1 day/date (bit6: 1 for day, 0 for date)
+	 *  A field takes part in the match when its mask bit (bit 7) is 0
+	 */
+	uint8_t m = masks[mode];
+	uint8_t alarm[4];
+	alarm[0] = dec2bcd(sec)  | (m & 0b0001 ? 0x80 : 0); // second
+	alarm[1] = dec2bcd(min)  | (m & 0b0010 ? 0x80 : 0); // minute
+	alarm[2] = dec2bcd(hour) | (m & 0b0100 ? 0x80 : 0); // hour
+	alarm[3] = dec2bcd(day ? day : 1) | (m & 0b1000 ? 0x80 : 0) |
+		(mode == ALARM_WEEKLY ? 0x40 : 0);                // day or date
+	writeBlock(0x07, alarm, 4);
+
+	// clear alarm flag
+	write_byte(m_status & ~0b00000001, 0x0f);
 }
 
 void WireRtcLib::setAlarm(WireRtcLib::tm* tm)
@@ -451,15 +1375,56 @@ void WireRtcLib::setAlarm(WireRtcLib::tm* tm)
 // get the currently set alarm
 void WireRtcLib::getAlarm_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
 {
-	if (m_is_ds1307) {
-		if (hour) *hour = getSramByte(0);
-		if (min)  *min  = getSramByte(1);
-		if (sec)  *sec  = getSramByte(2);
-	}
-	else {
-		*sec  = bcd2dec(read_byte(0x07) & ~0b10000000);
-		*min  = bcd2dec(read_byte(0x08) & ~0b10000000);
-		*hour = bcd2dec(read_byte(0x09) & ~0b10000000);
+	if (m_is_ds1307) getAlarm1307(hour, min, sec);
+	else             getAlarm3231(hour, min, sec);
+}
+
+void WireRtcLib::getAlarm1307(uint8_t* hour, uint8_t* min, uint8_t* sec)
+{
+	alarmLoad1307();
+	if (hour) *hour = m_alarm_secs / 3600;
+	if (min)  *min  = m_alarm_secs / 60 % 60;
+	if (sec)  *sec  = m_alarm_secs % 60;
+}
+
+void WireRtcLib::getAlarm3231(uint8_t* hour, uint8_t* min, uint8_t* sec)
+{
+	uint8_t alarm[3];
+
+	readBlock(0x07, alarm, 3);
+	if (sec)  *sec  = bcd2dec(alarm[0] & ~0b10000000);
+	if (min)  *min  = bcd2dec(alarm[1] & ~0b10000000);
+	if (hour) *hour = bcd2dec(alarm[2] & ~0b10000000);
+}
+
+// get the mode of the currently set alarm, and its day of week or date
+enum WireRtcLib::RTC_ALARM_MODE WireRtcLib::getAlarmMode(uint8_t* day)
+{
+	if (m_is_ds1307) return getAlarmMode1307(day);
+	return getAlarmMode3231(day);
+}
+
+enum WireRtcLib::RTC_ALARM_MODE WireRtcLib::getAlarmMode1307(uint8_t* day)
+{
+	alarmLoad1307();
+	if (day) *day = m_alarm_day;
+	return (enum RTC_ALARM_MODE)m_alarm_mode;
+}
+
+enum WireRtcLib::RTC_ALARM_MODE WireRtcLib::getAlarmMode3231(uint8_t* day)
+{
+	uint8_t alarm[4];
+
+	readBlock(0x07, alarm, 4);
+	if (day) *day = bcd2dec(alarm[3] & 0x3F);
+
+	uint8_t m = (alarm[0] >> 7) | ((alarm[1] >> 6) & 0b0010) | ((alarm[2] >> 5) & 0b0100) | ((alarm[3] >> 4) & 0b1000);
+	switch (m) {
+	case 0b1111: return ALARM_EVERY_SECOND;
+	case 0b1110: return ALARM_EVERY_MINUTE;
+	case 0b1100: return ALARM_HOURLY;
+	case 0b0000: return (alarm[3] & 0x40) ? ALARM_WEEKLY : ALARM_MONTHLY;
+	default:     return ALARM_DAILY;
 	}
 }
 
@@ -468,6 +1433,12 @@ WireRtcLib::tm* WireRtcLib::getAlarm()
 	uint8_t hour, min, sec;
 
 	getAlarm_s(&hour, &min, &sec);
+	return alarmTime(hour, min, sec);
+}
+
+// store an alarm time in the statically allocated tm structure
+WireRtcLib::tm* WireRtcLib::alarmTime(uint8_t hour, uint8_t min, uint8_t sec)
+{
 	m_tm.hour = hour;
 	m_tm.min = min;
 	m_tm.sec = sec;
@@ -478,31 +1449,138 @@ WireRtcLib::tm* WireRtcLib::getAlarm()
 // must be polled more than once a second
 bool WireRtcLib::checkAlarm(void)
 {
-	if (m_is_ds1307) {
-		uint8_t hour = getSramByte(0);
-		uint8_t min  = getSramByte(1);
-		uint8_t sec  = getSramByte(2);
+	if (m_is_ds1307) return checkAlarm1307();
+	return checkAlarm3231();
+}
 
-		uint8_t cur_hour, cur_min, cur_sec;
-		getTime_s(&cur_hour, &cur_min, &cur_sec);
-		
-		if (cur_hour == hour && cur_min == min && cur_sec == sec)
-			return true;
-		return false;
+bool WireRtcLib::checkAlarm1307(void)
+{
+	bool fired;
+
+	if (m_alarm_int) {
+		// count from the chip's time again now and then
+		if (!m_alarm_armed || m_alarm_ticks >= ALARM_RESYNC)
+			alarmArm1307(!m_alarm_armed);
+	}
+	else if (!m_alarm_armed) {
+		alarmArm1307(true);
 	}
 	else {
-		// Alarm 1 flag (A1F) in bit 0
-		uint8_t val = read_byte(0x0f);
+		// count the seconds since the last poll
+		uint8_t rtc[7];
+		bool match;
+
+		readBlock(0, rtc, m_alarm_period ? 3 : 7);
+		uint32_t now = decodeSecs(rtc);
+		uint32_t elapsed = (now + SECS_PER_DAY - m_alarm_last) % SECS_PER_DAY;
+		m_alarm_last = now;
 
-		// clear flag when set
-		if (val & 1)
-			write_byte(val & ~0b00000001, 0x0f);
-			
-		return val & 1 ? 1 : 0;
+		if (elapsed < m_alarm_left) {
+			m_alarm_left -= elapsed;
+		}
+		else {
+			m_alarm_fired = true;
+			if (m_alarm_period)
+				m_alarm_left = m_alarm_period - (elapsed - m_alarm_left) % m_alarm_period;
+			else
+				m_alarm_left = alarmUntil1307(rtc, &match);
+		}
 	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		fired = m_alarm_fired;
+		m_alarm_fired = false;
+	}
+	return fired;
 }
 
-static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; // january is month 0
+bool WireRtcLib::checkAlarm3231(void)
+{
+	if (m_alarm_int) {
+		// only go to the bus when the interrupt has seen the alarm
+		if (!m_alarm_fired) return false;
+		m_alarm_fired = false;
+		write_byte(m_status & ~0b00000001, 0x0f);
+		return true;
+	}
+
+	// Alarm 1 flag (A1F) in bit 0
+	uint8_t val = read_byte(0x0f);
+
+	// clear flag when set
+	if (val & 1)
+		write_byte(m_status & ~0b00000001, 0x0f);
+		
+	return val & 1 ? 1 : 0;
+}
+
+bool WireRtcLib::enableAlarmInterrupt(uint8_t pin, void (*handler)(void))
+{
+	if (m_is_ds1307) return enableAlarmInterrupt1307(pin, handler);
+	return enableAlarmInterrupt3231(pin, handler);
+}
+
+bool WireRtcLib::enableAlarmInterrupt1307(uint8_t pin, void (*handler)(void))
+{
+	m_alarm_handler = handler;
+	m_alarm_fired = false;
+
+	// count down on the 1Hz square wave, in one control register write
+	beginUpdate();
+	SQWSetFreq1307(FREQ_1);
+	SQWEnable1307(true);
+	leaveUpdate();
+	flushShadow1307();
+
+	m_alarm_int = true;
+	m_alarm_tick = &WireRtcLib::alarmTick1307;
+	attachPin(pin);
+	m_alarm_armed = false;
+	alarmArm1307(true);
+	return true;
+}
+
+bool WireRtcLib::enableAlarmInterrupt3231(uint8_t pin, void (*handler)(void))
+{
+	disableSoftClock();
+	m_alarm_handler = handler;
+	m_alarm_fired = false;
+
+	// INTCN and A1IE, and a flag left from before cleared so that INT is
+	// released: one write covers both registers and any pending changes
+	// to them
+	m_control |= 0b00000101;
+	uint8_t regs[2] = { m_control, (uint8_t)(m_status & ~0b00000001) };
+	writeBlock(0x0E, regs, 2);
+	m_dirty &= ~(SHADOW_CONTROL | SHADOW_STATUS);
+
+	m_alarm_int = true;
+	attachPin(pin);
+	return true;
+}
+
+void WireRtcLib::disableAlarmInterrupt(void)
+{
+	if (!m_alarm_int) return;
+
+	m_alarm_int = false;
+	if (m_is_ds1307) {
+		// checkAlarm counts from its own reads again
+		m_alarm_armed = false;
+		return; // the square wave may serve the soft clock
+	}
+
+	m_control &= ~0b00000001; // A1IE
+	m_dirty |= SHADOW_CONTROL;
+	flushShadow();
+}
+
+// Calendar conversion works on years that start on March 1st, so that the
+// leap day is the last day of the year and month lengths follow a fixed
+// pattern. Days are counted from 1600-03-01, the start of a 400 year cycle;
+// 1970-01-01 is day 135080.
+#define DAYS_1600_TO_1970 135080UL
+#define DAYS_PER_400Y     146097UL
 
 void WireRtcLib::breakTime(time_t time, WireRtcLib::tm* tm)
 {
@@ -510,9 +1588,9 @@ void WireRtcLib::breakTime(time_t time, WireRtcLib::tm* tm)
 // this is a more compact version of the C library localtime function
 // note that year is offset from 1970 !!!
 
-  uint8_t year;
-  uint8_t month, monthLength;
   unsigned long days;
+  uint16_t era, yoe, doy, year;
+  uint8_t mp;
   
   tm->sec = time % 60;
   time /= 60; // now it is minutes
@@ -522,38 +1600,22 @@ void WireRtcLib::breakTime(time_t time, WireRtcLib::tm* tm)
   time /= 24; // now it is days
   tm->wday = ((time + 4) % 7) + 1;  // Sunday is day 1 
   
-  year = 0;  
-  days = 0;
-  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
-    year++;
-  }
-  tm->year = year; // year is offset from 1970 
+  days = time + DAYS_1600_TO_1970;
+  era = days / DAYS_PER_400Y;
+  days -= era * DAYS_PER_400Y; // day of the 400 year cycle, 0-146096
   
-  days -= LEAP_YEAR(year) ? 366 : 365;
-  time  -= days; // now it is days in this year, starting at 0
+  // year of the cycle, 0-399: take out the leap days before dividing
+  yoe = (days - days/1460 + days/36524 - days/146096) / 365;
+  // day of the year, 0-365 (March 1st is 0)
+  doy = days - (365UL*yoe + yoe/4 - yoe/100);
+  // month of the year, 0-11 (March is 0)
+  mp = (5*doy + 2) / 153;
   
-  days=0;
-  month=0;
-  monthLength=0;
-  for (month=0; month<12; month++) {
-    if (month==1) { // february
-      if (LEAP_YEAR(year)) {
-        monthLength=29;
-      } else {
-        monthLength=28;
-      }
-    } else {
-      monthLength = monthDays[month];
-    }
-    
-    if (time >= monthLength) {
-      time -= monthLength;
-    } else {
-        break;
-    }
-  }
-  tm->mon = month + 1;  // jan is month 1  
-  tm->mday = time + 1;     // day of month
+  tm->mday = doy - (153*mp + 2)/5 + 1;
+  tm->mon = mp < 10 ? mp + 3 : mp - 9;  // jan is month 1
+  
+  year = 1600 + era*400 + yoe + (tm->mon <= 2);
+  tm->year = year - 1970; // year is offset from 1970
 }
 
 time_t WireRtcLib::makeTime(WireRtcLib::tm* tm){   
@@ -561,28 +1623,14 @@ time_t WireRtcLib::makeTime(WireRtcLib::tm* tm){
 // note year argument is offset from 1970 (see macros in time.h to convert to other formats)
 // previous version used full four digit year (or digits since 2000),i.e. 2009 was 2009 or 9
   
-  int i;
-  time_t seconds;
-
-  // seconds from 1970 till 1 jan 00:00:00 of the given year
-  seconds= tm->year*(SECS_PER_DAY * 365);
-  for (i = 0; i < tm->year; i++) {
-    if (LEAP_YEAR(i)) {
-      seconds +=  SECS_PER_DAY;   // add extra days for leap years
-    }
-  }
+  uint16_t yoe = 1970 - 1600 + tm->year - (tm->mon <= 2); // January and February belong to the previous year
+  uint8_t mp = tm->mon > 2 ? tm->mon - 3 : tm->mon + 9;   // March is 0
+  unsigned long days;
+  
+  // days from 1600-03-01 to the first of the month, then to the given day
+  days = 365UL*yoe + yoe/4 - yoe/100 + yoe/400;
+  days += (153*mp + 2)/5 + tm->mday - 1;
+  days -= DAYS_1600_TO_1970;
   
-  // add days for this year, months start from 1
-  for (i = 1; i < tm->mon; i++) {
-    if ( (i == 2) && LEAP_YEAR(tm->year)) { 
-      seconds += SECS_PER_DAY * 29;
-    } else {
-      seconds += SECS_PER_DAY * monthDays[i-1];  //monthDay array starts from 0
-    }
-  }
-  seconds+= (tm->mday-1) * SECS_PER_DAY;
-  seconds+= tm->hour * SECS_PER_HOUR;
-  seconds+= tm->min * SECS_PER_MIN;
-  seconds+= tm->sec;
-  return seconds; 
+  return days * SECS_PER_DAY + tm->hour * SECS_PER_HOUR + tm->min * SECS_PER_MIN + tm->sec;
 }
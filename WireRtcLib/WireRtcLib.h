@@ -39,9 +39,36 @@
 #define SECS_PER_WEEK (SECS_PER_DAY * DAYS_PER_WEEK)
 #define SECS_PER_YEAR (SECS_PER_WEEK * 52UL)
 #define SECS_YR_2000  (946684800UL) // the time at the start of y2k
+#define SECS_YR_2100  (4102444800UL) // the first time the chip can't hold
 
 typedef unsigned long time_t;
 
+// Transport: how the driver reaches the chip. By default this is the Arduino
+// Wire library. To use another bus, build with WIRERTC_TRANSPORT set to a
+// class with the same static functions as WireTransport, declared in the
+// header named by WIRERTC_TRANSPORT_HEADER. The calls are resolved at
+// compile time.
+#ifdef WIRERTC_TRANSPORT_HEADER
+#  include WIRERTC_TRANSPORT_HEADER
+#endif
+
+#ifndef WIRERTC_TRANSPORT
+#define WIRERTC_TRANSPORT WireTransport
+#define WIRERTC_WIRE_TRANSPORT
+
+class WireTransport {
+public:
+  /** Set the register pointer, then read with a repeated start
+   * @return number of bytes read
+   */
+  static uint8_t read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len);
+  /** Write len registers starting at reg
+   * @return 0 on success
+   */
+  static uint8_t write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len);
+};
+#endif
+
 class WireRtcLib {
 public:
   class tm {
@@ -63,11 +90,74 @@ private:
   bool m_is_ds3231;
   tm m_tm;
 
+  // control register shadow
+  uint8_t m_control;      // 0x07 (DS1307) or 0x0E (DS3231)
+  uint8_t m_status;       // 0x0F (DS3231)
+  int8_t m_aging;         // 0x10 (DS3231)
+  uint8_t m_dirty;
+  uint8_t m_update_depth;
+
+  // time registers as last read or written, for adjustTime
+  uint8_t m_time_image[7];
+  uint8_t m_time_known;   // bit n: register n is in the image
+
+  // software clock
+  static WireRtcLib* s_instance; // receives the square wave interrupt
+  volatile bool m_soft_clock;
+  volatile bool m_soft_edge;
+  bool m_soft_valid;
+  volatile uint16_t m_soft_ticks;
+  uint16_t m_soft_resync;
+  tm m_soft_tm;
+
+  // alarm interrupt
+  volatile bool m_alarm_int;
+  volatile bool m_alarm_fired;
+  void (*m_alarm_handler)(void);
+
+  // temperature conversion
+  uint8_t m_temp_state;
+  uint16_t m_temp_polled; // millis() of the start or the last poll
+  uint8_t m_temp[2];      // the result: 0x11 and 0x12
+  void (*m_temp_callback)(int8_t i, uint8_t f);
+
+  // DS1307 alarm: the SRAM alarm and a countdown to it
+  bool m_alarm_cached;
+  uint32_t m_alarm_secs;    // hour:min:sec as seconds of the day
+  uint8_t m_alarm_mode;
+  uint8_t m_alarm_day;      // day of week or date
+  uint8_t m_alarm_mon;      // monthly: month and year of the next match
+  uint8_t m_alarm_year;
+  uint32_t m_alarm_period;  // seconds between matches, 0: monthly
+  volatile bool m_alarm_armed;
+  volatile uint32_t m_alarm_left;
+  uint32_t m_alarm_last;
+  volatile uint16_t m_alarm_ticks;
+  // set once the engine runs: the code shared with WireRtc<Ds3231> only
+  // reaches it through these, so that build doesn't link it
+  void (WireRtcLib::*m_alarm_written)(uint8_t reg, const uint8_t* buf, uint8_t len);
+  void (WireRtcLib::*m_alarm_tick)(void);
+
 public:
   WireRtcLib();
 
   /** Initialize the RTC and autodetect type (DS1307 or DS3231) */
   void begin();
+
+  // Register block access
+  /** Read a block of consecutive registers, split into as few bursts as the transport allows
+   * @param reg first register to read
+   * @param buf buffer to store len bytes in
+   * @param len number of registers to read
+   */
+  void readBlock(uint8_t reg, uint8_t* buf, uint8_t len);
+
+  /** Write a block of consecutive registers, split into as few bursts as the transport allows
+   * @param reg first register to write
+   * @param buf len bytes to write
+   * @param len number of registers to write
+   */
+  void writeBlock(uint8_t reg, uint8_t* buf, uint8_t len);
   
   // Autodetection
   /** Check if the clock chip is a DS1307 */
@@ -94,6 +184,42 @@ public:
    */
   void getTime_s(uint8_t* hour, uint8_t* min, uint8_t* sec);
 
+  // Fields for getFields(): bit n is time register n
+  static const uint8_t FIELD_SEC  = 0b00000001;
+  static const uint8_t FIELD_MIN  = 0b00000010;
+  static const uint8_t FIELD_HOUR = 0b00000100;
+  static const uint8_t FIELD_WDAY = 0b00001000;
+  static const uint8_t FIELD_MDAY = 0b00010000;
+  static const uint8_t FIELD_MON  = 0b00100000;
+  static const uint8_t FIELD_YEAR = 0b01000000;
+  static const uint8_t FIELD_12H  = 0b10000000; // am and twelveHour, from the hour
+  static const uint8_t FIELD_TIME = FIELD_SEC | FIELD_MIN | FIELD_HOUR;
+  static const uint8_t FIELD_DATE = FIELD_MDAY | FIELD_MON | FIELD_YEAR;
+  static const uint8_t FIELD_ALL  = 0b01111111;
+
+  /** Gets only some of the time fields, in one burst from the first register to the last:
+   *  the seconds alone are 1 byte, FIELD_DATE 3 bytes from 04h
+   * @param mask FIELD_ values
+   * @return the statically allocated WireRtcLib::tm, with the other fields left as they were
+   */
+  WireRtcLib::tm* getFields(uint8_t mask);
+
+  /** Gets the time and other registers as of the same second. Up to register 0Fh this is one
+   *  burst from register 0, further registers are read separately. Registers past the time are
+   *  followed by a read of the seconds, and the whole read is repeated if they changed meanwhile.
+   *  Always reads the chip.
+   * @param reg first register to read along with the time
+   * @param buf receives len registers from reg
+   * @return the statically allocated WireRtcLib::tm
+   */
+  WireRtcLib::tm* getSnapshot(uint8_t reg, uint8_t* buf, uint8_t len);
+
+  /** Gets the time as seconds since 1970-01-01, decoded straight from the registers without
+   *  going through WireRtcLib::tm. Subtract SECS_YR_2000 for seconds since 2000.
+   *  The chip's years are taken as 2000-2099.
+   */
+  time_t getEpoch(void);
+
   /** Set the time
    * @param tm Pointer to a WireRtcLib::tm structure filled with the time data to set
    *           Note that
@@ -107,27 +233,104 @@ public:
    */
   void setTime_s(uint8_t hour, uint8_t min, uint8_t sec);
 
+  /** Set the time from seconds since 1970-01-01
+   * @param t 2000-01-01 to 2099-12-31; times outside that are clamped to it
+   */
+  void setEpoch(time_t t);
+
+  /** Set the time, writing only the registers from the first that differs from what the library
+   *  last read or wrote to the last: a seconds correction is a 1 byte write. Fields that are left
+   *  out are taken to still hold on the chip, so read the time, correct it and adjust it before the
+   *  clock carries into a field the correction doesn't change. The clock halt and century bits
+   *  are kept as they are.
+   * @param tm Pointer to a WireRtcLib::tm structure filled with the time data to set
+   */
+  void adjustTime(WireRtcLib::tm* tm);
+
+  // Software clock
+  static const uint8_t NO_PIN = 0xFF;
+
+  /** Serve getTime() and getTime_s() from RAM without touching the bus. The 1Hz square wave
+   *  is enabled and a RAM copy of the time is advanced on each of its falling edges.
+   * @param pin Interrupt capable pin the square wave output (DS1307 SQW/OUT, DS3231 INT/SQW) is wired to,
+   *            or NO_PIN to call handleInterrupt() from your own interrupt handler
+   * @param resyncInterval Re-read the time from the chip after this many seconds (0: only after setTime)
+   *  Turning the square wave off or moving it off 1Hz (SQWEnable, SQWSetFreq, configure) turns the
+   *  software clock off.
+   */
+  void enableSoftClock(uint8_t pin, uint16_t resyncInterval);
+  void disableSoftClock(void);
+  /** Square wave or alarm interrupt handler, called on every falling edge */
+  void handleInterrupt(void);
+
   // start/stop clock running (DS1307 only)
   void runClock(bool run);
   bool isClockRunning(void);
 
   // Temperature (DS3231 only)
   void getTemp(int8_t* i, uint8_t* f);
+  /** Start a temperature conversion
+   * @param block Wait for the conversion, reading CONV every TEMP_POLL_MS milliseconds
+   */
   void forceTempConversion(uint8_t block);
 
+  enum TEMP_STATE { TEMP_IDLE = 0, TEMP_CONVERTING, TEMP_READY };
+  /** Start a temperature conversion and return at once; pollTempConversion() finishes it
+   * @param callback Called from pollTempConversion() with the temperature (may be NULL)
+   * @return false on a DS1307 or while a conversion is running
+   */
+  bool startTempConversion(void (*callback)(int8_t i, uint8_t f));
+  /** Read CONV and BSY together with the temperature, at most every TEMP_POLL_MS milliseconds;
+   *  call from loop()
+   * @return TEMP_READY once both are clear, until getTempResult()
+   */
+  enum TEMP_STATE pollTempConversion(void);
+  /** The temperature of the last conversion */
+  void getTempResult(int8_t* i, uint8_t* f);
+
   // SRAM read/write (DS1307 only)
   void getSram(uint8_t* data);
   void setSram(uint8_t *data);
   uint8_t getSramByte(uint8_t offset);
   void setSramByte(uint8_t b, uint8_t offset);
 
+  // Control register shadow
+  // The control registers are read once by begin() and kept in RAM.
+  /** Hold back control register writes until endUpdate(), so that a sequence of
+   *  configuration calls costs a single bus transaction
+   */
+  void beginUpdate(void);
+  /** Write back everything changed since beginUpdate() */
+  void endUpdate(void);
+  /** Re-read the control registers, if something else may have changed them */
+  void reloadShadow(void);
+
   // Auxillary functions
   enum RTC_SQW_FREQ { FREQ_1 = 0, FREQ_1024, FREQ_4096, FREQ_8192 };
 
+  /** DS3231: the square wave takes INT/SQW over, ending the alarm interrupt */
   void SQWEnable(bool enable);
   void SQWSetFreq(enum RTC_SQW_FREQ freq);
   void Osc32kHzEnable(bool enable);
 
+  /** Board configuration, see configure() */
+  class config {
+    public:
+    bool sqw;             // square wave output; DS3231: BBSQW, and INTCN when off
+                          // (on ends the alarm interrupt, as SQWEnable)
+    enum RTC_SQW_FREQ freq;
+    bool out;             // DS1307: SQW/OUT level while the square wave is off
+    uint8_t alarmInt;     // DS3231: interrupt enables, bit 0 alarm 1, bit 1 alarm 2
+    bool osc32kHz;        // DS3231: 32kHz output
+    int8_t aging;         // DS3231: aging offset
+  };
+  /** Compare with the control register shadow and write what changed in one burst:
+   *  DS1307 07h, DS3231 from the first of 0Eh-10h that changed to the last
+   */
+  void configure(const config& c);
+  /** The configuration in the shadow; no bus access */
+  void getConfig(config* c);
+
   // Alarm functionality
   void resetAlarm(void);
   void setAlarm(WireRtcLib::tm* tm);
@@ -135,18 +338,204 @@ public:
   WireRtcLib::tm* getAlarm();
   void getAlarm_s(uint8_t* hour, uint8_t* min, uint8_t* sec);
   bool checkAlarm(void);
+
+  /** Alarm modes: the fields that must match the time */
+  enum RTC_ALARM_MODE {
+    ALARM_DAILY = 0,    // hour, minute and second (setAlarm_s)
+    ALARM_EVERY_SECOND,
+    ALARM_EVERY_MINUTE, // second
+    ALARM_HOURLY,       // minute and second
+    ALARM_WEEKLY,       // day of week, hour, minute and second
+    ALARM_MONTHLY       // date, hour, minute and second
+  };
+
+  /** Set the alarm with a mode.
+   *  DS3231: the A1M1-A1M4 mask bits and DY/DT of alarm 1, so the chip does the matching.
+   *  DS1307: the mode and day go to SRAM bytes 3 and 4 and the alarm countdown follows them;
+   *  arming reads the day of week (weekly) or date (monthly) too.
+   * @param mode Fields that must match
+   * @param day Day of week (1-7) for ALARM_WEEKLY, date (1-31) for ALARM_MONTHLY, ignored otherwise
+   */
+  void setAlarmMode(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec);
+  /** @param day Set to the day of week or date of the alarm (may be NULL) */
+  enum RTC_ALARM_MODE getAlarmMode(uint8_t* day);
+
+  /** Deliver the alarm by interrupt instead of polling.
+   *  DS3231: sets INTCN and A1IE so that INT/SQW goes low when alarm 1 matches; the soft clock is
+   *  turned off. checkAlarm() then only goes to the bus after the alarm went off, to clear the
+   *  alarm flag, which releases INT/SQW for the next alarm.
+   *  DS1307: enables the 1Hz square wave and counts down to the alarm on its edges; the soft
+   *  clock can run on the same pin. A change that stops the square wave ends the interrupt, as
+   *  disableAlarmInterrupt(). The count goes on without polling, but Wire can't be used
+   *  from the interrupt, so it is only checked against the chip's time (at most once an hour)
+   *  when checkAlarm() is called.
+   * @param pin Interrupt capable pin INT/SQW (SQW/OUT) is wired to, or NO_PIN to call handleInterrupt() yourself
+   * @param handler Called from the interrupt when the alarm goes off (may be NULL); must not use Wire
+   * @return true
+   */
+  bool enableAlarmInterrupt(uint8_t pin, void (*handler)(void));
+  void disableAlarmInterrupt(void);
 	
 	// Conversion utilities
 	void breakTime(time_t time, WireRtcLib::tm* tm);  // break time_t into elements
 	time_t makeTime(WireRtcLib::tm* tm);  // convert time elements into time_t
 
+protected:
+  // Chip specific halves of the public functions above, which pick one at
+  // runtime. WireRtc<Chip> picks one at compile time, so that the other
+  // chip's code is not linked in.
+  void setChip(bool is_ds1307);
+  void leaveUpdate(void);
+  void startSoftClock(uint8_t pin, uint16_t resyncInterval);
+  void attachPin(uint8_t pin);
+  WireRtcLib::tm* alarmTime(uint8_t hour, uint8_t min, uint8_t sec);
+
+  void reloadShadow1307(void);
+  void reloadShadow3231(void);
+  void flushShadow1307(void);
+  void flushShadow3231(void);
+  void runClock1307(bool run);
+  bool isClockRunning1307(void);
+  void getTemp3231(int8_t* i, uint8_t* f);
+  void forceTempConversion3231(uint8_t block);
+  bool startTempConversion3231(void (*callback)(int8_t i, uint8_t f));
+  enum TEMP_STATE pollTempConversion3231(void);
+  void SQWEnable1307(bool enable);
+  void SQWEnable3231(bool enable);
+  void SQWSetFreq1307(enum RTC_SQW_FREQ freq);
+  void SQWSetFreq3231(enum RTC_SQW_FREQ freq);
+  void SQWChanged1307(void);
+  void SQWChanged3231(void);
+  void Osc32kHzEnable3231(bool enable);
+  void configure1307(const config& c);
+  void configure3231(const config& c);
+  void getConfig1307(config* c);
+  void getConfig3231(config* c);
+  void resetAlarm1307(void);
+  void resetAlarm3231(void);
+  void setAlarmMode1307(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec);
+  void setAlarmMode3231(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec);
+  enum RTC_ALARM_MODE getAlarmMode1307(uint8_t* day);
+  enum RTC_ALARM_MODE getAlarmMode3231(uint8_t* day);
+  void getAlarm1307(uint8_t* hour, uint8_t* min, uint8_t* sec);
+  void getAlarm3231(uint8_t* hour, uint8_t* min, uint8_t* sec);
+  bool checkAlarm1307(void);
+  bool checkAlarm3231(void);
+  bool enableAlarmInterrupt1307(uint8_t pin, void (*handler)(void));
+  bool enableAlarmInterrupt3231(uint8_t pin, void (*handler)(void));
+  uint8_t alarmRegs1307(void);
+  uint16_t alarmNextMonth1307(uint8_t mday);
+  uint32_t alarmUntil1307(const uint8_t* rtc, bool* match);
+  void alarmCache1307(const uint8_t* alarm);
+  void alarmLoad1307(void);
+  void alarmStart1307(const uint8_t* rtc, bool catchUp);
+  void alarmArm1307(bool catchUp);
+  void alarmChanged1307(const uint8_t* alarm);
+  void alarmWritten1307(uint8_t reg, const uint8_t* buf, uint8_t len);
+  void alarmTick1307(void);
+
 private:
   uint8_t dec2bcd(uint8_t d);
   uint8_t bcd2dec(uint8_t b);
   uint8_t read_byte(uint8_t offset);
   void write_byte(uint8_t b, uint8_t offset);
-  void write_addr(uint8_t addr);
+  void flushShadow(void);
+  void timeSeen(uint8_t reg, const uint8_t* buf, uint8_t len);
+  void update12h(WireRtcLib::tm* t);
+  void decodeTime(const uint8_t* rtc);
+  void softSync(void);
+  bool softCurrent(void);
+  static void isr(void);
+};
+
+// Chip types for WireRtc<Chip>
+struct Ds1307 { static const bool is_ds1307 = true; };
+struct Ds3231 { static const bool is_ds1307 = false; };
+
+/** Driver for a board with a known chip: WireRtc<Ds1307> or WireRtc<Ds3231>.
+ *  begin() skips autodetection and the code for the other chip is left out.
+ *  Use WireRtcLib to detect the chip at runtime instead.
+ */
+template<class Chip>
+class WireRtc : public WireRtcLib {
+public:
+  WireRtc() { setChip(Chip::is_ds1307); }
+
+  /** Initialize the RTC */
+  void begin() { reloadShadow(); }
+
+  bool isDS1307(void) { return Chip::is_ds1307; }
+  bool isDS3231(void) { return !Chip::is_ds1307; }
+
+  void enableSoftClock(uint8_t pin, uint16_t resyncInterval)
+  {
+    beginUpdate();
+    SQWSetFreq(FREQ_1);
+    SQWEnable(true);
+    endUpdate();
+    startSoftClock(pin, resyncInterval);
+  }
+
+  void runClock(bool run) { if (Chip::is_ds1307) runClock1307(run); }
+  bool isClockRunning(void) { return Chip::is_ds1307 ? isClockRunning1307() : true; }
+
+  void getTemp(int8_t* i, uint8_t* f)
+  {
+    if (Chip::is_ds1307) { *i = 0; *f = 0; }
+    else getTemp3231(i, f);
+  }
+  void forceTempConversion(uint8_t block) { if (!Chip::is_ds1307) forceTempConversion3231(block); }
+  bool startTempConversion(void (*callback)(int8_t i, uint8_t f))
+  {
+    return Chip::is_ds1307 ? false : startTempConversion3231(callback);
+  }
+  enum TEMP_STATE pollTempConversion(void) { return Chip::is_ds1307 ? TEMP_IDLE : pollTempConversion3231(); }
+
+  void endUpdate(void) { leaveUpdate(); flushShadow(); }
+  void reloadShadow(void) { if (Chip::is_ds1307) reloadShadow1307(); else reloadShadow3231(); }
+
+  void SQWEnable(bool enable) { if (Chip::is_ds1307) SQWEnable1307(enable); else SQWEnable3231(enable); }
+  void SQWSetFreq(enum RTC_SQW_FREQ freq) { if (Chip::is_ds1307) SQWSetFreq1307(freq); else SQWSetFreq3231(freq); }
+  void Osc32kHzEnable(bool enable) { if (!Chip::is_ds1307) Osc32kHzEnable3231(enable); }
+  void configure(const config& c) { if (Chip::is_ds1307) configure1307(c); else configure3231(c); }
+  void getConfig(config* c) { if (Chip::is_ds1307) getConfig1307(c); else getConfig3231(c); }
+
+  void resetAlarm(void) { if (Chip::is_ds1307) resetAlarm1307(); else resetAlarm3231(); }
+  void setAlarm(WireRtcLib::tm* tm) { if (tm) setAlarm_s(tm->hour, tm->min, tm->sec); }
+  void setAlarm_s(uint8_t hour, uint8_t min, uint8_t sec) { setAlarmMode(ALARM_DAILY, 0, hour, min, sec); }
+  void setAlarmMode(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+  {
+    if (Chip::is_ds1307) setAlarmMode1307(mode, day, hour, min, sec);
+    else setAlarmMode3231(mode, day, hour, min, sec);
+  }
+  enum RTC_ALARM_MODE getAlarmMode(uint8_t* day)
+  {
+    return Chip::is_ds1307 ? getAlarmMode1307(day) : getAlarmMode3231(day);
+  }
+  WireRtcLib::tm* getAlarm()
+  {
+    uint8_t hour, min, sec;
+    getAlarm_s(&hour, &min, &sec);
+    return alarmTime(hour, min, sec);
+  }
+  void getAlarm_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
+  {
+    if (Chip::is_ds1307) getAlarm1307(hour, min, sec);
+    else getAlarm3231(hour, min, sec);
+  }
+  bool checkAlarm(void) { return Chip::is_ds1307 ? checkAlarm1307() : checkAlarm3231(); }
+  bool enableAlarmInterrupt(uint8_t pin, void (*handler)(void))
+  {
+    return Chip::is_ds1307 ? enableAlarmInterrupt1307(pin, handler) : enableAlarmInterrupt3231(pin, handler);
+  }
+
+private:
+  // the chip type is fixed
+  void setDS1307(void);
+  void setDS3231(void);
+
+  void flushShadow(void) { if (Chip::is_ds1307) flushShadow1307(); else flushShadow3231(); }
 };
 	
 #endif // WIRETRCLIB_H
-
+
@@ -0,0 +1,117 @@
+/*
+ * Wire RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011-2013 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+// Temperature history (see WireRtcTemp.h)
+
+#include "WireRtcTemp.h"
+
+#define CONV_PERIOD 64000UL // ms between the chip's own conversions
+
+WireRtcTemp::WireRtcTemp(WireRtcLib& rtc)
+: m_rtc(rtc)
+, m_running(false)
+, m_due(0)
+, m_head(0)
+, m_count(0)
+, m_sum(0)
+, m_ewma(0)
+, m_min(0)
+, m_max(0)
+{}
+
+bool WireRtcTemp::begin(void)
+{
+	if (m_rtc.isDS1307()) return false;
+
+	m_head = 0;
+	m_count = 0;
+	m_sum = 0;
+	m_due = millis();
+	m_running = true;
+	return true;
+}
+
+void WireRtcTemp::add(int16_t q)
+{
+	if (m_count == WIRERTC_TEMP_LOG_LEN) m_sum -= m_log[m_head];
+	else                                 m_count++;
+
+	m_log[m_head] = q;
+	m_sum += q;
+	if (++m_head == WIRERTC_TEMP_LOG_LEN) m_head = 0;
+
+	if (m_count == 1) {
+		// the first sample since begin()
+		m_min = m_max = q;
+		m_ewma = (int32_t)q << WIRERTC_TEMP_EWMA_SHIFT;
+		return;
+	}
+
+	if (q < m_min) m_min = q;
+	if (q > m_max) m_max = q;
+	m_ewma += q - (m_ewma >> WIRERTC_TEMP_EWMA_SHIFT);
+}
+
+bool WireRtcTemp::poll(void)
+{
+	uint32_t now = millis();
+	uint8_t regs[4];
+
+	if (!m_running || (int32_t)(now - m_due) < 0) return false;
+
+	// status, aging offset and temperature in one read
+	m_rtc.readBlock(0x0F, regs, 4);
+
+	if (regs[0] & 0b00000100) {
+		// BSY: the registers change within 200ms, and the conversion
+		// after this one starts 64 seconds from now
+		m_due = now + 1000;
+		return false;
+	}
+	m_due = now + CONV_PERIOD;
+
+	add((int16_t)(int8_t)regs[2] * 4 + (regs[3] >> 6));
+	return true;
+}
+
+void WireRtcTemp::getStats(stats* s)
+{
+	int32_t n = m_count;
+
+	s->count = m_count;
+	if (!n) {
+		s->last = s->min = s->max = s->mean = s->ewma = 0;
+		return;
+	}
+
+	s->last = get(0);
+	s->min = m_min;
+	s->max = m_max;
+	// rounded down; C division would round a negative sum up
+	s->mean = m_sum >= 0 ? m_sum / n : -((-m_sum + n - 1) / n);
+	s->ewma = m_ewma >> WIRERTC_TEMP_EWMA_SHIFT;
+}
+
+int16_t WireRtcTemp::get(uint8_t age)
+{
+	return m_log[(m_head + WIRERTC_TEMP_LOG_LEN - 1 - age) % WIRERTC_TEMP_LOG_LEN];
+}
+
+void WireRtcTemp::split(int16_t q, int8_t* i, uint8_t* f)
+{
+	// as the chip has it: integer part rounded down, quarters on top
+	*i = q >> 2;
+	*f = (q & 3) * 25;
+}
@@ -0,0 +1,78 @@
+/*
+ * Wire RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011-2013 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+#ifndef WIRERTCTEMP_H
+#define WIRERTCTEMP_H
+
+#include "WireRtcLib.h"
+
+#define WIRERTC_TEMP_LOG_LEN 32
+// weight of a new sample in the moving average: 1 / (1 << shift)
+#define WIRERTC_TEMP_EWMA_SHIFT 3
+
+/** Temperature history (DS3231 only).
+ *  The DS3231 converts the temperature every 64 seconds by itself, so that reading it more often
+ *  returns the same value. poll(), called from loop(), reads it once per conversion into a ring
+ *  buffer and keeps running statistics; the readers don't go to the bus.
+ *  Temperatures are Q8.2 fixed point: quarter degrees in an int16_t, as the chip has them.
+ *  A read that finds BSY set (a conversion running) is repeated a second later, and from then on
+ *  the samples come just after each conversion, give or take the drift of millis().
+ */
+class WireRtcTemp {
+public:
+  /** All Q8.2 */
+  struct stats {
+    int16_t last;
+    int16_t min;   // since begin()
+    int16_t max;
+    int16_t mean;  // of the samples in the ring buffer, rounded down
+    int16_t ewma;  // exponentially weighted moving average, rounded down
+    uint8_t count; // samples in the ring buffer
+  };
+
+  WireRtcTemp(WireRtcLib& rtc);
+
+  /** Clear the history; the next poll() samples
+   * @return false on a DS1307
+   */
+  bool begin(void);
+  /** Sample when the next conversion is due
+   * @return true when a sample was added
+   */
+  bool poll(void);
+
+  void getStats(stats* s);
+  /** @param age Samples back, 0 for the last; must be less than count */
+  int16_t get(uint8_t age);
+
+  /** Q8.2 to integer and hundredths, as getTemp() */
+  static void split(int16_t q, int8_t* i, uint8_t* f);
+
+private:
+  WireRtcLib& m_rtc;
+  bool m_running;
+  uint32_t m_due;                       // millis() of the next read
+  int16_t m_log[WIRERTC_TEMP_LOG_LEN];
+  uint8_t m_head;                       // where the next sample goes
+  uint8_t m_count;
+  int32_t m_sum;                        // of the samples in m_log
+  int32_t m_ewma;                       // Q8.2 << WIRERTC_TEMP_EWMA_SHIFT
+  int16_t m_min;
+  int16_t m_max;
+
+  void add(int16_t q);
+};
+
+#endif // WIRERTCTEMP_H
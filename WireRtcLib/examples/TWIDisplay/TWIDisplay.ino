@@ -17,8 +17,11 @@
 #include <Wire.h>
 #include <TWIDisplay.h>
 #include "WireRtcLib.h"
+#include "WireRtcTemp.h"
 
 WireRtcLib rtc;
+// the DS3231 converts every 64 seconds: read each conversion once
+WireRtcTemp temp(rtc);
 
 #define SLAVE_ADDR 0x12 // 7-seg
 
@@ -30,6 +33,7 @@ void setup()
   rtc.begin();
   disp.setBrightness(255);
   disp.clear();
+  temp.begin();
 
   if (rtc.isDS1307())
     disp.print(1307);
@@ -44,15 +48,18 @@ void setup()
 void loop()
 {
   for (int i = 0; i < 40; i++) {
-    WireRtcLib::tm* t = rtc.getTime();
+    WireRtcLib::tm* t = rtc.getFields(WireRtcLib::FIELD_TIME);
+    temp.poll();
 
     if (rtc.isDS1307() || i < 20) {
       disp.writeTime(t->hour, t->min, t->sec);
     }
     else {
+      WireRtcTemp::stats s;
       int8_t i;
       uint8_t f;
-      rtc.getTemp(&i, &f);
+      temp.getStats(&s);
+      WireRtcTemp::split(s.last, &i, &f);
       disp.writeTemperature(i, f, 'C');
     }
     
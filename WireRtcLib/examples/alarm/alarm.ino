@@ -31,6 +31,12 @@ void setup()
     Serial.println("Detected DS3231");
   else
     Serial.println("Autodetect failed");
+
+  // INT/SQW (DS3231) or SQW/OUT (DS1307) wired to pin 2. DS3231: the
+  // alarm pulls the pin low and checkAlarm() stays off the bus until then.
+  // DS1307: the 1Hz square wave is turned on and the alarm is counted down
+  // on its edges; checkAlarm() reads the time about once an hour.
+  rtc.enableAlarmInterrupt(2, NULL);
 }
 
 void loop()
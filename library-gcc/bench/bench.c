@@ -0,0 +1,52 @@
+/*
+ * DS RTC Library: bus cost benchmark
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "bench.h"
+
+static const char* s_lib;
+static const char* s_chip;
+static uint32_t s_freq;
+
+void bench_section(const char* lib, enum sim_chip chip, uint32_t freq)
+{
+	s_lib = lib;
+	s_chip = chip == SIM_DS1307 ? "DS1307" : "DS3231";
+	s_freq = freq;
+
+	sim_init(chip);
+	sim_set_bus_freq(freq);
+	sim_set_pin_handler(0);
+}
+
+void bench_row(const char* call)
+{
+	struct sim_stats stats;
+
+	sim_stats_get(&stats);
+	printf("%s\t%s\t%s\t%lu\t%u\t%u\t%u\t%u\t%lu\n", s_lib, s_chip, call,
+		(unsigned long)s_freq, stats.transactions, stats.starts, stats.stops,
+		stats.bytes, (unsigned long)stats.bus_us);
+}
+
+uint64_t bench_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
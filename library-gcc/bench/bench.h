@@ -0,0 +1,55 @@
+/*
+ * DS RTC Library: bus cost benchmark
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Each measured call becomes one tab separated row:
+ *
+ *   lib chip call freq transactions starts stops bytes us
+ *
+ * lib, chip, call and freq identify the row; check.awk compares the rest
+ * against baseline.tsv.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "rtc-sim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Power up a simulated chip at the given bus frequency. The rows that
+// follow are reported for lib on that chip.
+void bench_section(const char* lib, enum sim_chip chip, uint32_t freq);
+
+// Write a row with the bus usage since the last sim_stats_reset
+void bench_row(const char* call);
+
+// Host monotonic clock, in ns: for the calls that don't use the bus
+uint64_t bench_clock_ns(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+// Measure the statements in ... as one row
+#define BENCH(call, ...) do { \
+		sim_stats_reset(); \
+		__VA_ARGS__; \
+		bench_row(call); \
+	} while (0)
+
+#endif
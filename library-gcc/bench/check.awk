@@ -0,0 +1,47 @@
+# check.awk
+# (C) 2011 Akafugu Corporation
+#
+# This program is free software; you can redistribute it and/or modify it under the
+# terms of the GNU General Public License as published by the Free Software
+# Foundation; either version 2 of the License, or (at your option) any later
+# version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+# PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+# awk -F'\t' -f check.awk baseline.tsv results.tsv
+#
+# Fails when a row of results costs more than the same row of the baseline
+# in any column, or when a row of the baseline is gone from the results (a
+# call that is no longer measured can't get more expensive). New rows are
+# listed but don't fail.
+
+FNR == 1 { for (i = 1; i <= NF; i++) name[i] = $i; next }
+
+{ key = $1 " " $2 " " $3 " @" $4 }
+
+FILENAME == ARGV[1] { for (i = 5; i <= NF; i++) base[key, i] = $i; rows[key] = 1; next }
+
+{
+	seen[key] = 1
+	if (!(key in rows)) { print "new:   " key; next }
+	for (i = 5; i <= NF; i++) {
+		if ($i + 0 > base[key, i] + 0) {
+			print "WORSE: " key ": " name[i] " " base[key, i] " -> " $i
+			failed = 1
+		}
+		else if ($i + 0 < base[key, i] + 0)
+			print "better: " key ": " name[i] " " base[key, i] " -> " $i
+	}
+}
+
+END {
+	for (key in rows)
+		if (!(key in seen)) { print "gone:  " key; gone = 1 }
+	if (failed)
+		print "bus cost went up; if that is intended, run make baseline"
+	if (gone)
+		print "rows of the baseline are gone; if that is intended, run make baseline"
+	if (failed || gone) exit 1
+}
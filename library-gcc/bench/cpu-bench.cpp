@@ -0,0 +1,313 @@
+/*
+ * Wire RTC Library: CPU cost benchmark
+ * (C) 2011-2013 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * The helpers that don't use the bus, against the implementations they
+ * replaced: first every result is checked against the old one, then both
+ * are timed on the host. The timings depend on the machine, so they are
+ * printed rather than compared with a baseline. Exits with 1 if a result
+ * differs.
+ */
+
+#include <stdio.h>
+#include <Arduino.h>
+#include "WireRtcLib.h"
+#include "bench.h"
+
+static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; // january is month 0
+
+// makeTime/breakTime before they were made constant time: a loop over the
+// years since 1970 and the months of the year
+static void __attribute__((noinline)) old_breakTime(time_t time, WireRtcLib::tm* tm)
+{
+  uint8_t year;
+  uint8_t month, monthLength;
+  unsigned long days;
+
+  tm->sec = time % 60;
+  time /= 60; // now it is minutes
+  tm->min = time % 60;
+  time /= 60; // now it is hours
+  tm->hour = time % 24;
+  time /= 24; // now it is days
+  tm->wday = ((time + 4) % 7) + 1;  // Sunday is day 1
+
+  year = 0;
+  days = 0;
+  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
+    year++;
+  }
+  tm->year = year; // year is offset from 1970
+
+  days -= LEAP_YEAR(year) ? 366 : 365;
+  time  -= days; // now it is days in this year, starting at 0
+
+  days=0;
+  month=0;
+  monthLength=0;
+  for (month=0; month<12; month++) {
+    if (month==1) { // february
+      if (LEAP_YEAR(year)) {
+        monthLength=29;
+      } else {
+        monthLength=28;
+      }
+    } else {
+      monthLength = monthDays[month];
+    }
+
+    if (time >= monthLength) {
+      time -= monthLength;
+    } else {
+        break;
+    }
+  }
+  tm->mon = month + 1;  // jan is month 1
+  tm->mday = time + 1;     // day of month
+}
+
+static time_t __attribute__((noinline)) old_makeTime(WireRtcLib::tm* tm)
+{
+  int i;
+  time_t seconds;
+
+  // seconds from 1970 till 1 jan 00:00:00 of the given year
+  seconds= tm->year*(SECS_PER_DAY * 365);
+  for (i = 0; i < tm->year; i++) {
+    if (LEAP_YEAR(i)) {
+      seconds +=  SECS_PER_DAY;   // add extra days for leap years
+    }
+  }
+
+  // add days for this year, months start from 1
+  for (i = 1; i < tm->mon; i++) {
+    if ( (i == 2) && LEAP_YEAR(tm->year)) {
+      seconds += SECS_PER_DAY * 29;
+    } else {
+      seconds += SECS_PER_DAY * monthDays[i-1];  //monthDay array starts from 0
+    }
+  }
+  seconds+= (tm->mday-1) * SECS_PER_DAY;
+  seconds+= tm->hour * SECS_PER_HOUR;
+  seconds+= tm->min * SECS_PER_MIN;
+  seconds+= tm->sec;
+  return seconds;
+}
+
+static bool same(const WireRtcLib::tm& a, const WireRtcLib::tm& b)
+{
+  return a.sec == b.sec && a.min == b.min && a.hour == b.hour && a.mday == b.mday &&
+    a.mon == b.mon && a.year == b.year && a.wday == b.wday;
+}
+
+// Every day from 1970 to 2099, each at another time of day: breakTime
+// against old_breakTime, and makeTime and old_makeTime back to the time
+static unsigned long check_time(WireRtcLib& rtc)
+{
+  unsigned long failed = 0;
+  WireRtcLib::tm tm, old;
+
+  for (time_t day = 0; day < SECS_YR_2100 / SECS_PER_DAY; day++) {
+    time_t t = day * SECS_PER_DAY + (day * 3607) % SECS_PER_DAY;
+
+    rtc.breakTime(t, &tm);
+    old_breakTime(t, &old);
+    if (!same(tm, old) || rtc.makeTime(&tm) != t || old_makeTime(&tm) != t) {
+      if (failed++ < 10)
+        printf("  time %lu: %d-%02d-%02d %02d:%02d:%02d, was %d-%02d-%02d %02d:%02d:%02d\n",
+          (unsigned long)t, 1970 + tm.year, tm.mon, tm.mday, tm.hour, tm.min, tm.sec,
+          1970 + old.year, old.mon, old.mday, old.hour, old.min, old.sec);
+    }
+  }
+  printf("makeTime/breakTime, every day 1970-2099: %lu differ\n", failed);
+  return failed;
+}
+
+// ns per call over the instants of one year
+#define TIME_CALLS 1000000UL
+
+static volatile unsigned long s_sink;
+
+static void time_year(WireRtcLib& rtc, uint16_t year)
+{
+  WireRtcLib::tm tm;
+  time_t start, step;
+  unsigned long sum = 0;
+  uint64_t ns[5];
+
+  tm.sec = tm.min = tm.hour = 0;
+  tm.mday = tm.mon = 1;
+  tm.year = year - 1970;
+  start = rtc.makeTime(&tm);
+  step = 365 * SECS_PER_DAY / 1000 + 1;
+
+  ns[0] = bench_clock_ns();
+  for (unsigned long i = 0; i < TIME_CALLS; i++) {
+    old_breakTime(start + (i % 1000) * step, &tm);
+    sum += tm.mday;
+  }
+  ns[1] = bench_clock_ns();
+  for (unsigned long i = 0; i < TIME_CALLS; i++) {
+    rtc.breakTime(start + (i % 1000) * step, &tm);
+    sum += tm.mday;
+  }
+  ns[2] = bench_clock_ns();
+  for (unsigned long i = 0; i < TIME_CALLS; i++) {
+    tm.mday = 1 + i % 28;
+    sum += old_makeTime(&tm);
+  }
+  ns[3] = bench_clock_ns();
+  for (unsigned long i = 0; i < TIME_CALLS; i++) {
+    tm.mday = 1 + i % 28;
+    sum += rtc.makeTime(&tm);
+  }
+  ns[4] = bench_clock_ns();
+  s_sink = sum;
+
+  printf("  %u: makeTime %6.1f -> %5.1f ns, breakTime %6.1f -> %5.1f ns\n", year,
+    (double)(ns[3] - ns[2]) / TIME_CALLS, (double)(ns[4] - ns[3]) / TIME_CALLS,
+    (double)(ns[1] - ns[0]) / TIME_CALLS, (double)(ns[2] - ns[1]) / TIME_CALLS);
+}
+
+// The time register decode, per byte as it was and packed four bytes to a
+// word as WireRtcLib::decodeTime and rtc.c do it now. Both are private to
+// the libraries, so the packed one is a copy: keep it in step.
+#define TIME_MASK_LO 0x073F7F7FUL // wday, hour, min, sec
+#define TIME_MASK_HI 0x00FF1F3FUL // -, year, month, mday
+
+static uint8_t bcd2dec(uint8_t b)
+{
+  return ((b/16 * 10) + (b % 16));
+}
+
+static void __attribute__((noinline)) old_decodeTime(const uint8_t* rtc, WireRtcLib::tm* tm)
+{
+  tm->sec  = bcd2dec(rtc[0] & 0x7F); // CH
+  tm->min  = bcd2dec(rtc[1] & 0x7F);
+  tm->hour = bcd2dec(rtc[2] & 0x3F); // 12/24
+  tm->wday = bcd2dec(rtc[3] & 0x07);
+  tm->mday = bcd2dec(rtc[4] & 0x3F);
+  tm->mon  = bcd2dec(rtc[5] & 0x1F); // century
+  tm->year = bcd2dec(rtc[6]);
+}
+
+static inline uint32_t bcd2dec_4(uint32_t b)
+{
+  return b - 6 * ((b >> 4) & 0x0F0F0F0FUL);
+}
+
+static inline uint32_t load_4(const uint8_t* p)
+{
+  return p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void __attribute__((noinline)) decodeTime(const uint8_t* rtc, WireRtcLib::tm* tm)
+{
+  uint32_t hi = rtc[4] | ((uint16_t)rtc[5] << 8) | ((uint32_t)rtc[6] << 16);
+  uint32_t lo = bcd2dec_4(load_4(rtc) & TIME_MASK_LO);
+
+  hi = bcd2dec_4(hi & TIME_MASK_HI);
+
+  tm->sec  = lo;
+  tm->min  = lo >> 8;
+  tm->hour = lo >> 16;
+  tm->wday = lo >> 24;
+  tm->mday = hi;
+  tm->mon  = hi >> 8;
+  tm->year = hi >> 16;
+}
+
+// Every value of every register byte, each lane against the others in
+// turn: sec/min/hour and mday/month/year through all 2^24 combinations
+static unsigned long check_decode(void)
+{
+  unsigned long failed = 0;
+  uint8_t rtc[7];
+  WireRtcLib::tm tm, old;
+
+  for (uint32_t v = 0; v < 0x1000000UL; v++) {
+    rtc[0] = rtc[4] = v;
+    rtc[1] = rtc[5] = v >> 8;
+    rtc[2] = rtc[6] = v >> 16;
+    rtc[3] = v * 7 >> 3;
+
+    decodeTime(rtc, &tm);
+    old_decodeTime(rtc, &old);
+    if (!same(tm, old) && failed++ < 10)
+      printf("  registers %02x %02x %02x %02x %02x %02x %02x\n",
+        rtc[0], rtc[1], rtc[2], rtc[3], rtc[4], rtc[5], rtc[6]);
+  }
+  printf("time register decode, every byte value: %lu differ\n", failed);
+  return failed;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CYCLES() __builtin_ia32_rdtsc()
+#else
+#define CYCLES() 0 // cycles are only counted on x86
+#endif
+
+#define DECODE_CALLS 10000000UL
+
+static void time_decode(void)
+{
+  // the times of one day, as the chip holds them
+  static uint8_t images[1440][7];
+  WireRtcLib::tm tm;
+  unsigned long sum = 0;
+  uint64_t ns[3], cycles[3];
+
+  for (uint16_t i = 0; i < 1440; i++) {
+    uint8_t dec[7] = { (uint8_t)(i % 60), (uint8_t)(i % 60), (uint8_t)(i / 60),
+      (uint8_t)(i % 7 + 1), (uint8_t)(i % 28 + 1), (uint8_t)(i % 12 + 1), 24 };
+    for (uint8_t r = 0; r < 7; r++) images[i][r] = (dec[r] / 10) << 4 | dec[r] % 10;
+    images[i][5] |= 0x80; // century
+  }
+
+  ns[0] = bench_clock_ns();
+  cycles[0] = CYCLES();
+  for (unsigned long i = 0; i < DECODE_CALLS; i++) {
+    old_decodeTime(images[i % 1440], &tm);
+    sum += tm.sec;
+  }
+  ns[1] = bench_clock_ns();
+  cycles[1] = CYCLES();
+  for (unsigned long i = 0; i < DECODE_CALLS; i++) {
+    decodeTime(images[i % 1440], &tm);
+    sum += tm.sec;
+  }
+  ns[2] = bench_clock_ns();
+  cycles[2] = CYCLES();
+  s_sink = sum;
+
+  printf("time register decode per call, per byte -> packed:\n");
+  printf("  %.1f -> %.1f ns, %.1f -> %.1f cycles\n",
+    (double)(ns[1] - ns[0]) / DECODE_CALLS, (double)(ns[2] - ns[1]) / DECODE_CALLS,
+    (double)(cycles[1] - cycles[0]) / DECODE_CALLS, (double)(cycles[2] - cycles[1]) / DECODE_CALLS);
+}
+
+int main(void)
+{
+  WireRtcLib rtc;
+  unsigned long failed = check_time(rtc) + check_decode();
+
+  printf("makeTime/breakTime per call, old -> new:\n");
+  time_year(rtc, 1970);
+  time_year(rtc, 2030);
+  time_year(rtc, 2099);
+  time_decode();
+
+  return failed ? 1 : 0;
+}
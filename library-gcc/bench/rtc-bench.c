@@ -0,0 +1,206 @@
+/*
+ * DS RTC Library: bus cost benchmark
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Every public function of rtc.h against both simulated chips, at 100kHz
+ * and 400kHz. The calls run in a fixed order so that the chip is in the
+ * same state on every run.
+ */
+
+#include "../twi.h"
+#include "../rtc.h"
+#include "../rtc-sched.h"
+#include "../rtc-temp.h"
+#include "bench.h"
+
+static void time_done(struct tm* t)
+{
+	(void)t;
+}
+
+static uint16_t temp_ms(void)
+{
+	return (uint16_t)(sim_now_us() / 1000);
+}
+
+static void job(uint8_t id)
+{
+	(void)id;
+}
+
+static void run(enum sim_chip chip, uint32_t freq)
+{
+	struct tm set = { 50, 59, 23, 28, 2, 2024, 4, false, 0 };
+	struct rtc_xfer xfer;
+	uint8_t buf[56];
+	uint8_t hour, min, sec;
+	int8_t ti;
+	uint8_t tf;
+	struct rtc_temp_stats stats;
+	struct rtc_config config;
+	struct tm adjust;
+	// a register block the benchmark may overwrite: SRAM or alarm 1
+	uint8_t reg = chip == SIM_DS1307 ? 0x08 : 0x07;
+
+	bench_section("rtc", chip, freq);
+	sim_set_pin_handler(rtc_int_handler);
+	twi_init_master();
+
+	BENCH("rtc_init", rtc_init());
+	if (chip == SIM_DS1307)
+		BENCH("rtc_set_ds1307", rtc_set_ds1307());
+	else
+		BENCH("rtc_set_ds3231", rtc_set_ds3231());
+	BENCH("rtc_is_ds1307", (void)rtc_is_ds1307());
+	BENCH("rtc_is_ds3231", (void)rtc_is_ds3231());
+
+	BENCH("rtc_set_time", rtc_set_time(&set));
+	BENCH("rtc_set_epoch", rtc_set_epoch(1709164790UL)); // the same time
+	BENCH("rtc_set_time_s", rtc_set_time_s(23, 59, 50));
+	BENCH("rtc_get_time", (void)rtc_get_time());
+	BENCH("rtc_get_time_s", rtc_get_time_s(&hour, &min, &sec));
+	BENCH("rtc_get_epoch", (void)rtc_get_epoch());
+	// a seconds correction, then the same time again
+	adjust = *rtc_get_time();
+	adjust.sec = (adjust.sec + 1) % 60;
+	BENCH("rtc_adjust_time sec", rtc_adjust_time(&adjust));
+	BENCH("rtc_adjust_time unchanged", rtc_adjust_time(&adjust));
+	BENCH("rtc_get_fields sec", (void)rtc_get_fields(RTC_FIELD_SEC));
+	BENCH("rtc_get_fields date", (void)rtc_get_fields(RTC_FIELD_DATE));
+	// registers in the same burst as the time, then past it
+	BENCH("rtc_get_snapshot near", (void)rtc_get_snapshot(0x07, buf, 7));
+	BENCH("rtc_get_snapshot far", (void)rtc_get_snapshot(0x11, buf, 2));
+
+	BENCH("rtc_read_block", rtc_read_block(reg, buf, 4));
+	BENCH("rtc_write_block", rtc_write_block(reg, buf, 4));
+	BENCH("rtc_read_block_async",
+		rtc_read_block_async(&xfer, 0, buf, 7, 0);
+		twi_sim_poll());
+	BENCH("rtc_get_time_async",
+		rtc_get_time_async(time_done);
+		twi_sim_poll());
+	BENCH("rtc_get_time_async_busy", (void)rtc_get_time_async_busy());
+
+	BENCH("rtc_run_clock", rtc_run_clock(true));
+	BENCH("rtc_is_clock_running", (void)rtc_is_clock_running());
+
+	if (chip == SIM_DS3231) {
+		BENCH("ds3231_get_temp_int", ds3231_get_temp_int(&ti, &tf));
+		BENCH("rtc_force_temp_conversion 0", rtc_force_temp_conversion(0));
+		BENCH("rtc_force_temp_conversion 1", rtc_force_temp_conversion(1));
+		BENCH("rtc_temp_start", rtc_temp_start(temp_ms(), 0));
+		BENCH("rtc_temp_poll early", rtc_temp_poll(temp_ms()));
+		// a main loop that comes round every 10ms
+		BENCH("rtc_temp_poll done",
+			do sim_advance_us(10000);
+			while (rtc_temp_poll(temp_ms()) != TEMP_READY));
+		BENCH("rtc_temp_result", rtc_temp_result(&ti, &tf));
+
+		BENCH("rtc_temp_log_start", rtc_temp_log_start(0));
+		BENCH("rtc_temp_log_poll sample", rtc_temp_log_poll(0));
+		BENCH("rtc_temp_log_poll idle", rtc_temp_log_poll(1));
+		BENCH("rtc_temp_log_stats", rtc_temp_log_stats(&stats));
+	}
+	else {
+		BENCH("rtc_get_sram", rtc_get_sram(buf));
+		BENCH("rtc_set_sram", rtc_set_sram(buf));
+		BENCH("rtc_get_sram_byte", (void)rtc_get_sram_byte(10));
+		BENCH("rtc_set_sram_byte", rtc_set_sram_byte(0x5a, 10));
+	}
+
+	// each control setting on its own, then batched
+	BENCH("rtc_SQW_set_freq", rtc_SQW_set_freq(FREQ_1024));
+	BENCH("rtc_SQW_enable", rtc_SQW_enable(false));
+	if (chip == SIM_DS3231)
+		BENCH("rtc_osc32kHz_enable", rtc_osc32kHz_enable(false));
+	BENCH("rtc_begin_update", rtc_begin_update());
+	BENCH("rtc_SQW_set_freq update", rtc_SQW_set_freq(FREQ_1));
+	BENCH("rtc_SQW_enable update", rtc_SQW_enable(true));
+	BENCH("rtc_end_update", rtc_end_update());
+	BENCH("rtc_reload_shadow", rtc_reload_shadow());
+
+	// the whole configuration at once, then again with nothing changed
+	BENCH("rtc_get_config", rtc_get_config(&config));
+	config.sqw = false;
+	config.freq = FREQ_4096;
+	config.osc32khz = true;
+	config.aging = -3;
+	BENCH("rtc_configure", rtc_configure(&config));
+	BENCH("rtc_configure unchanged", rtc_configure(&config));
+
+	BENCH("rtc_reset_alarm", rtc_reset_alarm());
+	BENCH("rtc_set_alarm", rtc_set_alarm(&set));
+	BENCH("rtc_set_alarm_s", rtc_set_alarm_s(0, 0, 20));
+	BENCH("rtc_get_alarm", (void)rtc_get_alarm());
+	BENCH("rtc_get_alarm_s", rtc_get_alarm_s(&hour, &min, &sec));
+	BENCH("rtc_set_alarm_mode", rtc_set_alarm_mode(ALARM_WEEKLY, 1, 6, 0, 0));
+	BENCH("rtc_get_alarm_mode", (void)rtc_get_alarm_mode(0));
+	rtc_set_alarm_s(0, 0, 20);
+	BENCH("rtc_check_alarm", (void)rtc_check_alarm());
+	sim_advance_us(30000000);
+	BENCH("rtc_check_alarm fired", (void)rtc_check_alarm());
+
+	BENCH("rtc_alarm_int_enable", rtc_alarm_int_enable(0));
+	rtc_get_time_s(&hour, &min, &sec);
+	rtc_set_alarm_s(hour, min + (sec + 5) / 60, (sec + 5) % 60);
+	sim_advance_us(3000000);
+	BENCH("rtc_check_alarm int", (void)rtc_check_alarm());
+	sim_advance_us(3000000);
+	// the DS3231 interrupt queued the flag clear
+	BENCH("rtc_check_alarm int fired",
+		twi_sim_poll();
+		(void)rtc_check_alarm());
+	BENCH("rtc_alarm_int_disable", rtc_alarm_int_disable());
+
+	if (chip == SIM_DS3231) {
+		BENCH("rtc_alarm_int_attach", rtc_alarm_int_attach(RTC_ALARM1 | RTC_ALARM2, 0));
+		BENCH("rtc_alarm_clear", rtc_alarm_clear(RTC_ALARM1 | RTC_ALARM2));
+		rtc_alarm_int_disable();
+
+		// a job on each alarm
+		rtc_get_time_s(&hour, &min, &sec);
+		BENCH("rtc_sched_add", rtc_sched_add(hour, min, sec, 5, job));
+		rtc_sched_add(hour, min, 0, 60, job);
+		BENCH("rtc_sched_start", rtc_sched_start());
+		BENCH("rtc_sched_run idle", rtc_sched_run());
+		sim_advance_us(5000000);
+		BENCH("rtc_sched_run fired", rtc_sched_run());
+		BENCH("rtc_sched_add running", rtc_sched_add(hour, min, sec, 0, job));
+		BENCH("rtc_sched_remove", rtc_sched_remove(2));
+		BENCH("rtc_sched_stop", rtc_sched_stop());
+		rtc_sched_remove(1);
+		rtc_sched_remove(0);
+	}
+
+	BENCH("rtc_soft_clock_enable", rtc_soft_clock_enable(0));
+	BENCH("rtc_get_time soft", (void)rtc_get_time());
+	BENCH("rtc_get_time_s soft", rtc_get_time_s(&hour, &min, &sec));
+	// the next square wave edge calls rtc_int_handler
+	BENCH("rtc_int_handler", sim_advance_us(1000000));
+	BENCH("rtc_get_time soft tick", (void)rtc_get_time());
+	BENCH("rtc_soft_clock_disable", rtc_soft_clock_disable());
+}
+
+int main(void)
+{
+	static const uint32_t freqs[] = { 100000, 400000 };
+	uint8_t i;
+
+	for (i = 0; i < sizeof(freqs) / sizeof(freqs[0]); i++) {
+		run(SIM_DS1307, freqs[i]);
+		run(SIM_DS3231, freqs[i]);
+	}
+	return 0;
+}
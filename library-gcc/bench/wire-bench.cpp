@@ -0,0 +1,179 @@
+/*
+ * Wire RTC Library: bus cost benchmark
+ * (C) 2011-2013 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Every public function of WireRtcLib.h, for WireRtcLib (autodetect) and
+ * WireRtc<Chip>, at 100kHz and 400kHz. The calls run in a fixed order so
+ * that the chip is in the same state on every run.
+ */
+
+#include <Arduino.h>
+#include "WireRtcLib.h"
+#include "WireRtcTemp.h"
+#include "bench.h"
+
+// setDS1307/setDS3231 are only public in WireRtcLib
+static void setChip(WireRtcLib& rtc, sim_chip chip)
+{
+  if (chip == SIM_DS1307)
+    BENCH("setDS1307", rtc.setDS1307());
+  else
+    BENCH("setDS3231", rtc.setDS3231());
+}
+
+template<class Chip>
+static void setChip(WireRtc<Chip>& rtc, sim_chip chip)
+{
+}
+
+template<class Rtc>
+static void run(const char* lib, sim_chip chip, uint32_t freq)
+{
+  Rtc rtc;
+  WireRtcLib::tm set = { 50, 59, 23, 28, 2, 24, 4, false, 0 };
+  uint8_t buf[56];
+  uint8_t hour, min, sec;
+  int8_t ti;
+  uint8_t tf;
+  WireRtcLib::config config;
+  WireRtcLib::tm adjust;
+  // a register block the benchmark may overwrite: SRAM or alarm 1
+  uint8_t reg = chip == SIM_DS1307 ? 0x08 : 0x07;
+
+  bench_section(lib, chip, freq);
+  Wire.begin();
+
+  BENCH("begin", rtc.begin());
+  setChip(rtc, chip);
+  BENCH("isDS1307", (void)rtc.isDS1307());
+  BENCH("isDS3231", (void)rtc.isDS3231());
+
+  BENCH("setTime", rtc.setTime(&set));
+  BENCH("setEpoch", rtc.setEpoch(1709164790UL)); // the same time
+  BENCH("setTime_s", rtc.setTime_s(23, 59, 50));
+  BENCH("getTime", (void)rtc.getTime());
+  BENCH("getTime_s", rtc.getTime_s(&hour, &min, &sec));
+  BENCH("getEpoch", (void)rtc.getEpoch());
+  // a seconds correction, then the same time again
+  adjust = *rtc.getTime();
+  adjust.sec = (adjust.sec + 1) % 60;
+  BENCH("adjustTime sec", rtc.adjustTime(&adjust));
+  BENCH("adjustTime unchanged", rtc.adjustTime(&adjust));
+  BENCH("getFields sec", (void)rtc.getFields(WireRtcLib::FIELD_SEC));
+  BENCH("getFields date", (void)rtc.getFields(WireRtcLib::FIELD_DATE));
+  // registers in the same burst as the time, then past it
+  BENCH("getSnapshot near", (void)rtc.getSnapshot(0x07, buf, 7));
+  BENCH("getSnapshot far", (void)rtc.getSnapshot(0x11, buf, 2));
+
+  BENCH("readBlock", rtc.readBlock(reg, buf, 4));
+  BENCH("writeBlock", rtc.writeBlock(reg, buf, 4));
+
+  BENCH("runClock", rtc.runClock(true));
+  BENCH("isClockRunning", (void)rtc.isClockRunning());
+
+  if (chip == SIM_DS3231) {
+    BENCH("getTemp", rtc.getTemp(&ti, &tf));
+    BENCH("forceTempConversion 0", rtc.forceTempConversion(0));
+    BENCH("forceTempConversion 1", rtc.forceTempConversion(1));
+    BENCH("startTempConversion", rtc.startTempConversion(0));
+    BENCH("pollTempConversion early", rtc.pollTempConversion());
+    // a loop() that comes round every 10ms
+    BENCH("pollTempConversion done",
+      do delay(10);
+      while (rtc.pollTempConversion() != WireRtcLib::TEMP_READY));
+    BENCH("getTempResult", rtc.getTempResult(&ti, &tf));
+
+    WireRtcTemp log(rtc);
+    WireRtcTemp::stats stats;
+    BENCH("WireRtcTemp begin", log.begin());
+    BENCH("WireRtcTemp poll sample", log.poll());
+    BENCH("WireRtcTemp poll idle", log.poll());
+    BENCH("WireRtcTemp getStats", log.getStats(&stats));
+  }
+  else {
+    BENCH("getSram", rtc.getSram(buf));
+    BENCH("setSram", rtc.setSram(buf));
+    BENCH("getSramByte", (void)rtc.getSramByte(10));
+    BENCH("setSramByte", rtc.setSramByte(0x5a, 10));
+  }
+
+  // each control setting on its own, then batched
+  BENCH("SQWSetFreq", rtc.SQWSetFreq(WireRtcLib::FREQ_1024));
+  BENCH("SQWEnable", rtc.SQWEnable(false));
+  if (chip == SIM_DS3231)
+    BENCH("Osc32kHzEnable", rtc.Osc32kHzEnable(false));
+  BENCH("beginUpdate", rtc.beginUpdate());
+  BENCH("SQWSetFreq update", rtc.SQWSetFreq(WireRtcLib::FREQ_1));
+  BENCH("SQWEnable update", rtc.SQWEnable(true));
+  BENCH("endUpdate", rtc.endUpdate());
+  BENCH("reloadShadow", rtc.reloadShadow());
+
+  // the whole configuration at once, then again with nothing changed
+  BENCH("getConfig", rtc.getConfig(&config));
+  config.sqw = false;
+  config.freq = WireRtcLib::FREQ_4096;
+  config.osc32kHz = true;
+  config.aging = -3;
+  BENCH("configure", rtc.configure(config));
+  BENCH("configure unchanged", rtc.configure(config));
+
+  BENCH("resetAlarm", rtc.resetAlarm());
+  BENCH("setAlarm", rtc.setAlarm(&set));
+  BENCH("setAlarm_s", rtc.setAlarm_s(0, 0, 20));
+  BENCH("getAlarm", (void)rtc.getAlarm());
+  BENCH("getAlarm_s", rtc.getAlarm_s(&hour, &min, &sec));
+  BENCH("setAlarmMode", rtc.setAlarmMode(WireRtcLib::ALARM_WEEKLY, 1, 6, 0, 0));
+  BENCH("getAlarmMode", (void)rtc.getAlarmMode(0));
+  rtc.setAlarm_s(0, 0, 20);
+  BENCH("checkAlarm", (void)rtc.checkAlarm());
+  sim_advance_us(30000000);
+  BENCH("checkAlarm fired", (void)rtc.checkAlarm());
+
+  BENCH("enableAlarmInterrupt", rtc.enableAlarmInterrupt(2, 0));
+  rtc.getTime_s(&hour, &min, &sec);
+  rtc.setAlarm_s(hour, min + (sec + 5) / 60, (sec + 5) % 60);
+  sim_advance_us(3000000);
+  BENCH("checkAlarm int", (void)rtc.checkAlarm());
+  sim_advance_us(3000000);
+  BENCH("checkAlarm int fired", (void)rtc.checkAlarm());
+  BENCH("disableAlarmInterrupt", rtc.disableAlarmInterrupt());
+
+  BENCH("enableSoftClock", rtc.enableSoftClock(2, 0));
+  BENCH("getTime soft", (void)rtc.getTime());
+  BENCH("getTime_s soft", rtc.getTime_s(&hour, &min, &sec));
+  // the next square wave edge calls handleInterrupt
+  BENCH("handleInterrupt", sim_advance_us(1000000));
+  BENCH("getTime soft tick", (void)rtc.getTime());
+  BENCH("disableSoftClock", rtc.disableSoftClock());
+
+  // no bus access, listed so that a change that adds some shows up
+  WireRtcLib::tm t = set;
+  time_t time = 0;
+  BENCH("makeTime", time = rtc.makeTime(&t));
+  BENCH("breakTime", rtc.breakTime(time, &t));
+}
+
+int main(void)
+{
+  static const uint32_t freqs[] = { 100000, 400000 };
+
+  for (uint8_t i = 0; i < sizeof(freqs) / sizeof(freqs[0]); i++) {
+    run<WireRtcLib>("WireRtcLib", SIM_DS1307, freqs[i]);
+    run<WireRtcLib>("WireRtcLib", SIM_DS3231, freqs[i]);
+    run<WireRtc<Ds1307> >("WireRtc<Ds1307>", SIM_DS1307, freqs[i]);
+    run<WireRtc<Ds3231> >("WireRtc<Ds3231>", SIM_DS3231, freqs[i]);
+  }
+  return 0;
+}
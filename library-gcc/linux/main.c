@@ -0,0 +1,51 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Reads a DS1307/DS3231 on a Linux I2C bus, e.g. on a Raspberry Pi:
+ *   ./rtc-linux /dev/i2c-1
+ */
+
+#include <stdio.h>
+
+#include "../rtc.h"
+#include "../rtc-transport.h"
+
+int main(int argc, char** argv)
+{
+	const char* dev = argc > 1 ? argv[1] : "/dev/i2c-1";
+	struct tm* t;
+
+	if (rtc_linux_open(dev) != 0) {
+		perror(dev);
+		return 1;
+	}
+
+	rtc_init();
+	printf("%s\n", rtc_is_ds1307() ? "DS1307" : "DS3231");
+
+	t = rtc_get_time();
+	printf("%04d-%02d-%02d %02d:%02d:%02d\n", t->year, t->mon, t->mday, t->hour, t->min, t->sec);
+
+	if (rtc_is_ds3231()) {
+		int8_t i;
+		uint8_t f;
+		ds3231_get_temp_int(&i, &f);
+		printf("%d.%02u C\n", i, f);
+	}
+
+	rtc_linux_close();
+	return 0;
+}
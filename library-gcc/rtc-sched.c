@@ -0,0 +1,323 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+// Scheduler on the DS3231 alarms (see rtc-sched.h)
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "rtc.h"
+#include "rtc-sched.h"
+
+#define SECS_PER_DAY 86400UL
+
+// heaps, one per alarm
+#define HEAP_A1 0 // any second
+#define HEAP_A2 1 // whole minutes
+
+struct rtc_job {
+	rtc_sched_fn fn;  // 0: free
+	uint32_t start;   // hour:min:sec as seconds of the day
+	uint32_t period;
+	uint32_t next;    // next run on the scheduler clock
+	uint8_t pos;      // index in its heap
+};
+
+static struct rtc_job s_jobs[RTC_SCHED_JOBS];
+static uint8_t s_heap[2][RTC_SCHED_JOBS]; // job ids, soonest first
+static uint8_t s_heap_len[2];
+static uint32_t s_programmed[2];          // next of the job in each alarm
+static uint8_t s_alarms;                  // interrupt enables
+
+// The scheduler clock counts seconds from rtc_sched_start; s_tod is the
+// time of day at s_now. Each read of the time adds the seconds since the
+// last one, which is why rtc_sched_run must come at least once a day.
+static bool s_running;
+static uint32_t s_now;
+static uint32_t s_tod;
+static volatile bool s_pending; // the alarm interrupt came
+
+// runs from the external interrupt
+static void sched_int(void)
+{
+	s_pending = true;
+}
+
+static uint8_t sched_heap_of(struct rtc_job* j)
+{
+	return (j->start % 60 == 0 && j->period % 60 == 0) ? HEAP_A2 : HEAP_A1;
+}
+
+static void sched_place(uint8_t h, uint8_t i, uint8_t id)
+{
+	s_heap[h][i] = id;
+	s_jobs[id].pos = i;
+}
+
+static void sched_sift_up(uint8_t h, uint8_t i)
+{
+	uint8_t id = s_heap[h][i];
+	uint8_t parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (s_jobs[s_heap[h][parent]].next <= s_jobs[id].next) break;
+		sched_place(h, i, s_heap[h][parent]);
+		i = parent;
+	}
+	sched_place(h, i, id);
+}
+
+static void sched_sift_down(uint8_t h, uint8_t i)
+{
+	uint8_t id = s_heap[h][i];
+	uint8_t len = s_heap_len[h];
+	uint8_t child;
+
+	while ((child = 2 * i + 1) < len) {
+		if (child + 1 < len && s_jobs[s_heap[h][child + 1]].next < s_jobs[s_heap[h][child]].next)
+			child++;
+		if (s_jobs[id].next <= s_jobs[s_heap[h][child]].next) break;
+		sched_place(h, i, s_heap[h][child]);
+		i = child;
+	}
+	sched_place(h, i, id);
+}
+
+static void sched_push(uint8_t id)
+{
+	uint8_t h = sched_heap_of(&s_jobs[id]);
+
+	sched_place(h, s_heap_len[h]++, id);
+	sched_sift_up(h, s_jobs[id].pos);
+}
+
+static void sched_pull(uint8_t id)
+{
+	uint8_t h = sched_heap_of(&s_jobs[id]);
+	uint8_t i = s_jobs[id].pos;
+
+	if (i == --s_heap_len[h]) return;
+
+	sched_place(h, i, s_heap[h][s_heap_len[h]]);
+	sched_sift_up(h, i);
+	sched_sift_down(h, s_jobs[s_heap[h][i]].pos);
+}
+
+// advance the scheduler clock to the chip's time: 24-hour mode only
+static void sched_sync(void)
+{
+	uint8_t rtc[3];
+	uint32_t tod;
+
+	rtc_read_block(0x0, rtc, 3);
+	tod = bcd2dec(rtc[2] & 0x3F) * 3600UL + bcd2dec(rtc[1] & 0x7F) * 60U + bcd2dec(rtc[0] & 0x7F);
+
+	s_now += (tod + SECS_PER_DAY - s_tod) % SECS_PER_DAY;
+	s_tod = tod;
+}
+
+// The first run after now: the runs are start + k * period. One in the
+// current second is left for the next period, as with the daily alarm.
+static uint32_t sched_first(struct rtc_job* j)
+{
+	uint32_t left = (j->start + SECS_PER_DAY - s_tod) % SECS_PER_DAY % j->period;
+	return s_now + (left ? left : j->period);
+}
+
+// Alarm registers for the soonest job of heap h: seconds, minutes, hours.
+// The mask bits A1M1-3 and A2M2-3 stay 0, so alarm 1 matches the seconds,
+// minutes and hours and alarm 2 the minutes and hours.
+static void sched_alarm_regs(uint8_t h, uint8_t* regs)
+{
+	uint32_t next = s_jobs[s_heap[h][0]].next;
+	uint32_t tod = (s_tod + next - s_now) % SECS_PER_DAY;
+
+	regs[0] = dec2bcd(tod % 60);
+	regs[1] = dec2bcd(tod / 60 % 60);
+	regs[2] = dec2bcd(tod / 3600);
+	s_programmed[h] = next;
+}
+
+// The soonest job of each heap into its alarm, and the interrupt enables
+// of the alarms that have one. Writes only what changed.
+static void sched_program(void)
+{
+	uint8_t regs[3];
+	uint8_t alarms = 0;
+	uint8_t h;
+
+	for (h = 0; h < 2; h++) {
+		if (!s_heap_len[h]) continue;
+		alarms |= h == HEAP_A1 ? RTC_ALARM1 : RTC_ALARM2;
+
+		if (s_jobs[s_heap[h][0]].next == s_programmed[h]) continue;
+
+		sched_alarm_regs(h, regs);
+		if (h == HEAP_A1) rtc_write_block(0x07, regs, 3);
+		else              rtc_write_block(0x0B, regs + 1, 2);
+	}
+
+	if (alarms != s_alarms) {
+		s_alarms = alarms;
+		rtc_alarm_int_attach(alarms, sched_int);
+	}
+}
+
+// Program the alarms. A job due in the next second may have been passed
+// by the chip while its alarm was written: look at the time again.
+static void sched_arm(void)
+{
+	uint8_t h;
+
+	sched_program();
+
+	for (h = 0; h < 2; h++) {
+		if (!s_heap_len[h] || s_jobs[s_heap[h][0]].next > s_now + 1) continue;
+
+		sched_sync();
+		if (s_jobs[s_heap[h][0]].next <= s_now) s_pending = true;
+	}
+}
+
+uint8_t rtc_sched_add(uint8_t hour, uint8_t min, uint8_t sec, uint32_t period, rtc_sched_fn fn)
+{
+	struct rtc_job* j;
+	uint8_t id;
+
+	if (hour > 23 || min > 59 || sec > 59 || period > SECS_PER_DAY || !fn)
+		return RTC_SCHED_NONE;
+
+	for (id = 0; id < RTC_SCHED_JOBS; id++)
+		if (!s_jobs[id].fn) break;
+	if (id == RTC_SCHED_JOBS) return RTC_SCHED_NONE;
+
+	j = &s_jobs[id];
+	j->fn = fn;
+	j->start = hour * 3600UL + min * 60U + sec;
+	j->period = period ? period : SECS_PER_DAY;
+
+	if (s_running) {
+		sched_sync();
+		j->next = sched_first(j);
+		sched_push(id);
+		sched_arm();
+	}
+
+	return id;
+}
+
+void rtc_sched_remove(uint8_t id)
+{
+	if (id >= RTC_SCHED_JOBS || !s_jobs[id].fn) return;
+
+	if (s_running) {
+		sched_pull(id);
+		sched_program();
+	}
+
+	s_jobs[id].fn = 0;
+}
+
+bool rtc_sched_start(void)
+{
+	// alarm 1 and alarm 2 with their day bytes: A1M4 and A2M4 set, any day
+	uint8_t regs[7] = { 0, 0, 0, 0x80, 0, 0, 0x80 };
+	uint8_t a2[3];
+	uint8_t id;
+
+	if (rtc_is_ds1307()) return false;
+
+	s_running = false;
+	s_now = 0;
+	s_tod = 0;
+	sched_sync();
+	s_now = 0;
+
+	s_heap_len[HEAP_A1] = 0;
+	s_heap_len[HEAP_A2] = 0;
+	for (id = 0; id < RTC_SCHED_JOBS; id++) {
+		if (!s_jobs[id].fn) continue;
+		s_jobs[id].next = sched_first(&s_jobs[id]);
+		sched_push(id);
+	}
+
+	// both alarms in one burst
+	s_programmed[HEAP_A1] = 0;
+	s_programmed[HEAP_A2] = 0;
+	if (s_heap_len[HEAP_A1]) sched_alarm_regs(HEAP_A1, regs);
+	if (s_heap_len[HEAP_A2]) {
+		sched_alarm_regs(HEAP_A2, a2);
+		regs[4] = a2[1];
+		regs[5] = a2[2];
+	}
+	rtc_write_block(0x07, regs, 7);
+
+	s_alarms = 0xFF;
+	s_pending = false;
+	s_running = true;
+	sched_arm();
+	return true;
+}
+
+void rtc_sched_stop(void)
+{
+	if (!s_running) return;
+
+	s_running = false;
+	rtc_alarm_int_disable();
+}
+
+uint8_t rtc_sched_run(void)
+{
+	struct rtc_job* j;
+	uint8_t ran = 0, n, h, id;
+	bool pending;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		pending = s_pending;
+		s_pending = false;
+	}
+	if (!s_running || !pending) return 0;
+
+	// release INT/SQW first: an alarm matching from here on interrupts again,
+	// and one that matched before is due by the time read below
+	rtc_alarm_clear(RTC_ALARM1 | RTC_ALARM2);
+
+	// until a pass finds nothing due: the jobs themselves take time
+	do {
+		sched_sync();
+		n = 0;
+
+		for (h = 0; h < 2; h++) {
+			while (s_heap_len[h] && s_jobs[s_heap[h][0]].next <= s_now) {
+				id = s_heap[h][0];
+				j = &s_jobs[id];
+
+				// once, however many runs were missed
+				j->next += ((s_now - j->next) / j->period + 1) * j->period;
+				sched_sift_down(h, 0);
+
+				j->fn(id);
+				n++;
+			}
+		}
+
+		ran += n;
+	} while (n);
+
+	sched_arm();
+	return ran;
+}
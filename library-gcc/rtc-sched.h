@@ -0,0 +1,63 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Scheduler: any number of jobs on the two DS3231 alarms (DS3231 only)
+ *
+ * Jobs are kept in RAM in two min-heaps ordered by their next run. Jobs that
+ * always run on a whole minute go on alarm 2, which matches hours and
+ * minutes; the others go on alarm 1. Each alarm holds the soonest job of its
+ * heap, so the chip interrupts once per run instead of every job polling it.
+ *
+ * rtc_sched_run, called from the main loop, stays off the bus until the
+ * interrupt and then runs the jobs that are due, which may use the bus.
+ * The scheduler owns both alarms and INT0 (see rtc_alarm_int_attach): the
+ * daily alarm (rtc_set_alarm_s) and the software clock can't be used while
+ * it runs.
+ */
+
+#ifndef RTC_SCHED_H
+#define RTC_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef RTC_SCHED_JOBS
+#define RTC_SCHED_JOBS 16
+#endif
+
+#define RTC_SCHED_NONE 0xFF
+
+// Called from rtc_sched_run with the job's id
+typedef void (*rtc_sched_fn)(uint8_t id);
+
+// Runs fn at hour:min:sec and then every period seconds (0: once a day, at
+// most 86400). A period that divides a day keeps the times the same every
+// day. Returns the job's id, or RTC_SCHED_NONE when all RTC_SCHED_JOBS are
+// taken or the time is out of range. Jobs can be added before and after
+// rtc_sched_start, also from a job.
+uint8_t rtc_sched_add(uint8_t hour, uint8_t min, uint8_t sec, uint32_t period, rtc_sched_fn fn);
+void rtc_sched_remove(uint8_t id);
+
+// Reads the time, programs the alarms and attaches the interrupt. Call it
+// again after the time is set. Returns false on a DS1307.
+bool rtc_sched_start(void);
+void rtc_sched_stop(void);
+
+// Runs the jobs that are due and returns how many ran. Only goes to the bus
+// after the alarm interrupt; must be called at least once a day.
+uint8_t rtc_sched_run(void);
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+// Temperature history (see rtc-temp.h)
+
+#include "rtc.h"
+#include "rtc-temp.h"
+
+#define CONV_PERIOD 64 // seconds between the chip's own conversions
+
+static bool s_running;
+static uint16_t s_due;                   // secs of the next read
+static int16_t s_log[RTC_TEMP_LOG_LEN];
+static uint8_t s_head;                   // where the next sample goes
+static uint8_t s_count;
+static int32_t s_sum;                    // of the samples in s_log
+static int32_t s_ewma;                   // Q8.2 << RTC_TEMP_EWMA_SHIFT
+static int16_t s_min, s_max;
+
+bool rtc_temp_log_start(uint16_t secs)
+{
+	if (rtc_is_ds1307()) return false;
+
+	s_head = 0;
+	s_count = 0;
+	s_sum = 0;
+	s_due = secs;
+	s_running = true;
+	return true;
+}
+
+static void rtc_temp_log_add(int16_t q)
+{
+	if (s_count == RTC_TEMP_LOG_LEN) s_sum -= s_log[s_head];
+	else                             s_count++;
+
+	s_log[s_head] = q;
+	s_sum += q;
+	if (++s_head == RTC_TEMP_LOG_LEN) s_head = 0;
+
+	if (s_count == 1) {
+		// the first sample since rtc_temp_log_start
+		s_min = s_max = q;
+		s_ewma = (int32_t)q << RTC_TEMP_EWMA_SHIFT;
+		return;
+	}
+
+	if (q < s_min) s_min = q;
+	if (q > s_max) s_max = q;
+	s_ewma += q - (s_ewma >> RTC_TEMP_EWMA_SHIFT);
+}
+
+bool rtc_temp_log_poll(uint16_t secs)
+{
+	uint8_t regs[4];
+
+	if (!s_running || (int16_t)(secs - s_due) < 0) return false;
+
+	// status, aging offset and temperature in one read
+	rtc_read_block(0x0F, regs, 4);
+
+	if (regs[0] & 0b00000100) {
+		// BSY: the registers change within 200ms, and the conversion
+		// after this one starts 64 seconds from now
+		s_due = secs + 1;
+		return false;
+	}
+	s_due = secs + CONV_PERIOD;
+
+	rtc_temp_log_add((int16_t)(int8_t)regs[2] * 4 + (regs[3] >> 6));
+	return true;
+}
+
+void rtc_temp_log_stats(struct rtc_temp_stats* stats)
+{
+	int32_t n = s_count;
+
+	stats->count = s_count;
+	if (!n) {
+		stats->last = stats->min = stats->max = stats->mean = stats->ewma = 0;
+		return;
+	}
+
+	stats->last = rtc_temp_log_get(0);
+	stats->min = s_min;
+	stats->max = s_max;
+	// rounded down; C division would round a negative sum up
+	stats->mean = s_sum >= 0 ? s_sum / n : -((-s_sum + n - 1) / n);
+	stats->ewma = s_ewma >> RTC_TEMP_EWMA_SHIFT;
+}
+
+int16_t rtc_temp_log_get(uint8_t age)
+{
+	return s_log[(s_head + RTC_TEMP_LOG_LEN - 1 - age) % RTC_TEMP_LOG_LEN];
+}
+
+void rtc_temp_split(int16_t q, int8_t* i, uint8_t* f)
+{
+	// as the chip has it: integer part rounded down, quarters on top
+	*i = q >> 2;
+	*f = (q & 3) * 25;
+}
@@ -0,0 +1,74 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Temperature history (DS3231 only)
+ *
+ * The DS3231 converts the temperature every 64 seconds by itself, so that
+ * reading it more often returns the same value. rtc_temp_log_poll, called
+ * from the main loop, reads it once per conversion into a ring buffer and
+ * keeps running statistics; the readers below don't go to the bus.
+ *
+ * Temperatures are Q8.2 fixed point: quarter degrees in an int16_t, as the
+ * chip has them (rtc_temp_split gives the pair of ds3231_get_temp_int).
+ *
+ * The samples follow the seconds count passed to rtc_temp_log_poll. A read
+ * that finds BSY set (a conversion running) is repeated a second later, and
+ * from then on the samples come just after each conversion. With a count
+ * that runs off the chip's clock (the software clock, the 1Hz square wave)
+ * each sample is a new conversion; one from another oscillator drifts, and
+ * now and then reads a conversion twice or skips one.
+ */
+
+#ifndef RTC_TEMP_H
+#define RTC_TEMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef RTC_TEMP_LOG_LEN
+#define RTC_TEMP_LOG_LEN 32
+#endif
+
+// weight of a new sample in the moving average: 1 / (1 << shift)
+#ifndef RTC_TEMP_EWMA_SHIFT
+#define RTC_TEMP_EWMA_SHIFT 3
+#endif
+
+// all Q8.2
+struct rtc_temp_stats {
+	int16_t last;
+	int16_t min;   // since rtc_temp_log_start
+	int16_t max;
+	int16_t mean;  // of the samples in the ring buffer, rounded down
+	int16_t ewma;  // exponentially weighted moving average, rounded down
+	uint8_t count; // samples in the ring buffer
+};
+
+// Clears the history; the next poll samples. Returns false on a DS1307.
+bool rtc_temp_log_start(uint16_t secs);
+// Samples when the next conversion is due; secs is a free running count of
+// seconds, and must not move on by more than 9 hours between calls. Returns
+// true when a sample was added.
+bool rtc_temp_log_poll(uint16_t secs);
+
+void rtc_temp_log_stats(struct rtc_temp_stats* stats);
+// The sample age samples back, 0 for the last; age must be less than count
+int16_t rtc_temp_log_get(uint8_t age);
+
+// Q8.2 to integer and hundredths, as ds3231_get_temp_int
+void rtc_temp_split(int16_t q, int8_t* i, uint8_t* f);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+// Transport backend for Linux i2c-dev (/dev/i2c-*), e.g. on a Raspberry Pi
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "rtc-transport.h"
+
+static int s_fd = -1;
+
+int rtc_linux_open(const char* dev)
+{
+	rtc_linux_close();
+	s_fd = open(dev, O_RDWR);
+	return s_fd < 0 ? -1 : 0;
+}
+
+void rtc_linux_close(void)
+{
+	if (s_fd >= 0) close(s_fd);
+	s_fd = -1;
+}
+
+// the messages are sent with repeated starts and one STOP at the end
+static bool rtc_linux_transfer(struct i2c_msg* msgs, int count)
+{
+	struct i2c_rdwr_ioctl_data data = { msgs, count };
+
+	return s_fd >= 0 && ioctl(s_fd, I2C_RDWR, &data) >= 0;
+}
+
+uint8_t rtc_linux_read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+	struct i2c_msg msgs[2] = {
+		{ address, 0, 1, &reg },
+		{ address, I2C_M_RD, len, buf },
+	};
+
+	if (len == 0) return 0;
+	return rtc_linux_transfer(msgs, 2) ? len : 0;
+}
+
+uint8_t rtc_linux_write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	uint8_t data[1 + 255];
+	struct i2c_msg msg = { address, 0, (uint16_t)(len + 1), data };
+
+	// one burst: the register pointer is the first byte
+	data[0] = reg;
+	memcpy(data + 1, buf, len);
+
+	return rtc_linux_transfer(&msg, 1) ? 0 : 2;
+}
+
+// There is no background queue: the transaction runs before this returns
+bool rtc_linux_submit(twi_xfer_t* xfer)
+{
+	struct i2c_msg msgs[2];
+	int count = 0;
+
+	if (xfer->txLength) {
+		msgs[count].addr = xfer->address;
+		msgs[count].flags = 0;
+		msgs[count].len = xfer->txLength;
+		msgs[count].buf = xfer->txData;
+		count++;
+	}
+	if (xfer->rxLength) {
+		msgs[count].addr = xfer->address;
+		msgs[count].flags = I2C_M_RD;
+		msgs[count].len = xfer->rxLength;
+		msgs[count].buf = xfer->rxData;
+		count++;
+	}
+	if (count == 0) return false;
+
+	xfer->next = 0;
+	xfer->status = rtc_linux_transfer(msgs, count) ? TWI_XFER_DONE : TWI_XFER_ERROR;
+	if (xfer->callback) xfer->callback(xfer);
+
+	return true;
+}
+
+#ifdef RTC_TRANSPORT_TABLE
+const struct rtc_transport rtc_transport_linux = { rtc_linux_read, rtc_linux_write, rtc_linux_submit };
+#endif
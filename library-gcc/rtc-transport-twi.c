@@ -0,0 +1,63 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+// Transport backend for twi.c: the AVR TWI hardware
+
+#include "twi.h"
+#include "rtc-transport.h"
+
+// Largest register block written in a single bus transaction: the register
+// pointer travels in the same TWI buffer. Reads go straight into the
+// caller's buffer and are never split.
+#define RTC_WRITE_BURST (BUFFER_LENGTH - 1)
+
+uint8_t rtc_twi_read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+	// set the register pointer and read back with a repeated start
+	twi_begin_transmission(address);
+	twi_send_byte(reg);
+	twi_end_transmission(0);
+
+	return twi_request_into(address, buf, len);
+}
+
+uint8_t rtc_twi_write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	uint8_t ret = 0;
+
+	while (len) {
+		uint8_t n = len > RTC_WRITE_BURST ? RTC_WRITE_BURST : len;
+
+		twi_begin_transmission(address);
+		twi_send_byte(reg);
+		twi_send((uint8_t*)buf, n);
+		if (twi_end_transmission(1) != 0) ret = 2;
+
+		reg += n;
+		buf += n;
+		len -= n;
+	}
+
+	return ret;
+}
+
+bool rtc_twi_submit(twi_xfer_t* xfer)
+{
+	return twi_submit(xfer) == 0;
+}
+
+#ifdef RTC_TRANSPORT_TABLE
+const struct rtc_transport rtc_transport_twi = { rtc_twi_read, rtc_twi_write, rtc_twi_submit };
+#endif
@@ -0,0 +1,97 @@
+/*
+ * DS RTC Library: DS1307 and DS3231 driver library
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Transport: how rtc.c reaches the chip
+ *
+ * Backends, selected at compile time:
+ *   RTC_TRANSPORT_TWI    twi.c on the AVR TWI hardware (default)
+ *   RTC_TRANSPORT_LINUX  Linux /dev/i2c-* (rtc-transport-linux.c)
+ *   RTC_TRANSPORT_SIM    the host simulator (sim/rtc-transport-sim.c)
+ *
+ * With one backend, rtc.c calls its functions directly. With more than one,
+ * calls go through the table set by rtc_set_transport (by default the first
+ * of the list above that is compiled in).
+ */
+
+#ifndef RTC_TRANSPORT_H
+#define RTC_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "twi-lowlevel.h"
+
+#if !defined(RTC_TRANSPORT_TWI) && !defined(RTC_TRANSPORT_LINUX) && !defined(RTC_TRANSPORT_SIM)
+#define RTC_TRANSPORT_TWI
+#endif
+
+struct rtc_transport {
+	// Set the register pointer to reg, then read len bytes after a repeated
+	// start. Returns the number of bytes read.
+	uint8_t (*read)(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len);
+	// Write len bytes starting at register reg, in as few bursts as the
+	// backend allows. Returns 0 on success.
+	uint8_t (*write)(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len);
+	// Queue a transaction (see twi_xfer_t). Returns false when it was not
+	// queued. Backends without a background queue complete it right away.
+	bool (*submit)(twi_xfer_t* xfer);
+};
+
+#ifdef RTC_TRANSPORT_TWI
+uint8_t rtc_twi_read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len);
+uint8_t rtc_twi_write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len);
+bool rtc_twi_submit(twi_xfer_t* xfer);
+extern const struct rtc_transport rtc_transport_twi;
+#endif
+
+#ifdef RTC_TRANSPORT_LINUX
+// dev: e.g. "/dev/i2c-1". Returns 0 on success, -1 with errno set
+int rtc_linux_open(const char* dev);
+void rtc_linux_close(void);
+uint8_t rtc_linux_read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len);
+uint8_t rtc_linux_write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len);
+bool rtc_linux_submit(twi_xfer_t* xfer);
+extern const struct rtc_transport rtc_transport_linux;
+#endif
+
+#ifdef RTC_TRANSPORT_SIM
+uint8_t rtc_sim_read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len);
+uint8_t rtc_sim_write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len);
+bool rtc_sim_submit(twi_xfer_t* xfer);
+extern const struct rtc_transport rtc_transport_sim;
+#endif
+
+#if defined(RTC_TRANSPORT_TWI) + defined(RTC_TRANSPORT_LINUX) + defined(RTC_TRANSPORT_SIM) > 1
+#define RTC_TRANSPORT_TABLE
+extern const struct rtc_transport* rtc_transport;
+void rtc_set_transport(const struct rtc_transport* transport);
+#define rtc_bus_read(a, r, b, l)  rtc_transport->read(a, r, b, l)
+#define rtc_bus_write(a, r, b, l) rtc_transport->write(a, r, b, l)
+#define rtc_bus_submit(x)         rtc_transport->submit(x)
+#elif defined(RTC_TRANSPORT_TWI)
+#define rtc_bus_read   rtc_twi_read
+#define rtc_bus_write  rtc_twi_write
+#define rtc_bus_submit rtc_twi_submit
+#elif defined(RTC_TRANSPORT_LINUX)
+#define rtc_bus_read   rtc_linux_read
+#define rtc_bus_write  rtc_linux_write
+#define rtc_bus_submit rtc_linux_submit
+#else
+#define rtc_bus_read   rtc_sim_read
+#define rtc_bus_write  rtc_sim_write
+#define rtc_bus_submit rtc_sim_submit
+#endif
+
+#endif
@@ -69,14 +69,19 @@
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stddef.h>
 
 #define TRUE 1
 #define FALSE 0
 
 #include "rtc.h"
+#include "rtc-transport.h"
 
 #define RTC_ADDR 0x68 // I2C address
 #define CH_BIT 7 // clock halt bit
+#define DS1307_SRAM_ADDR 0x08
 
 // statically allocated structure for time value
 struct tm _tm;
@@ -91,27 +96,133 @@ uint8_t bcd2dec(uint8_t b)
   return ((b/16 * 10) + (b % 16));
 }
 
-uint8_t rtc_read_byte(uint8_t offset)
+#ifdef RTC_TRANSPORT_TABLE
+#if defined(RTC_TRANSPORT_TWI)
+const struct rtc_transport* rtc_transport = &rtc_transport_twi;
+#elif defined(RTC_TRANSPORT_LINUX)
+const struct rtc_transport* rtc_transport = &rtc_transport_linux;
+#else
+const struct rtc_transport* rtc_transport = &rtc_transport_sim;
+#endif
+
+void rtc_set_transport(const struct rtc_transport* transport)
+{
+	rtc_transport = transport;
+}
+#endif
+
+// Image of the time registers as last read or written, for rtc_adjust_time
+static uint8_t s_time_image[7];
+static uint8_t s_time_known; // bit n: register n is in the image
+
+static void rtc_time_seen(uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	for (; len && reg < 7; reg++, buf++, len--) {
+		s_time_image[reg] = *buf;
+		s_time_known |= 1 << reg;
+	}
+}
+
+void rtc_read_block(uint8_t reg, uint8_t* buf, uint8_t len)
 {
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(offset);
-	twi_end_transmission();
+	uint8_t n = rtc_bus_read(RTC_ADDR, reg, buf, len);
+	rtc_time_seen(reg, buf, n);
 
-	twi_request_from(RTC_ADDR, 1);
-	return twi_receive();
+	// bytes the chip didn't deliver read as 0
+	while (n < len)
+		buf[n++] = 0;
+}
+
+static void rtc_alarm_written(uint8_t reg, const uint8_t* buf, uint8_t len);
+
+void rtc_write_block(uint8_t reg, uint8_t* buf, uint8_t len)
+{
+	rtc_bus_write(RTC_ADDR, reg, buf, len);
+	rtc_time_seen(reg, buf, len);
+	rtc_alarm_written(reg, buf, len);
+}
+
+uint8_t rtc_read_byte(uint8_t offset)
+{
+	uint8_t b;
+	rtc_read_block(offset, &b, 1);
+	return b;
 }
 
 void rtc_write_byte(uint8_t b, uint8_t offset)
 {
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(offset);
-	twi_send_byte(b);
-	twi_end_transmission();
+	rtc_write_block(offset, &b, 1);
 }
 
 static bool s_is_ds1307 = false;
 static bool s_is_ds3231 = false;
 
+// Shadow of the control registers, filled by rtc_init
+// DS1307: control (0x07)
+// DS3231: control (0x0E), control/status (0x0F) and aging offset (0x10)
+// Configuration changes are made here and written back by rtc_flush_shadow,
+// in one burst from the first DS3231 register that changed to the last
+#define SHADOW_CONTROL 0b00000001
+#define SHADOW_STATUS  0b00000010
+#define SHADOW_AGING   0b00000100
+
+// DS3231 status bits that are cleared by writing 0 and left alone by writing 1:
+// OSF, A2F, A1F. The shadow keeps them at 1 so a write-back never clears them
+#define DS3231_STATUS_FLAGS 0b10000011
+#define DS3231_A1F          0b00000001
+
+static uint8_t s_control;
+static uint8_t s_status;
+static int8_t s_aging;
+static uint8_t s_dirty;
+static uint8_t s_update_depth;
+
+void rtc_reload_shadow(void)
+{
+	if (s_is_ds1307) {
+		s_control = rtc_read_byte(0x07);
+	}
+	else {
+		uint8_t regs[3];
+		rtc_read_block(0x0E, regs, 3);
+		s_control = regs[0] & ~0b00100000; // CONV is cleared by the chip
+		s_status  = regs[1] | DS3231_STATUS_FLAGS;
+		s_aging   = regs[2];
+	}
+	s_dirty = 0;
+}
+
+static void rtc_flush_shadow(void)
+{
+	uint8_t regs[3] = { s_control, s_status, (uint8_t)s_aging };
+	uint8_t first, last;
+
+	if (s_update_depth || !s_dirty) return;
+
+	if (s_is_ds1307) {
+		rtc_write_byte(s_control, 0x07);
+	}
+	else {
+		// registers in between that didn't change are written as they are
+		first = (s_dirty & SHADOW_CONTROL) ? 0 : (s_dirty & SHADOW_STATUS) ? 1 : 2;
+		last  = (s_dirty & SHADOW_AGING)   ? 2 : (s_dirty & SHADOW_STATUS) ? 1 : 0;
+		rtc_write_block(0x0E + first, regs + first, last - first + 1);
+	}
+
+	s_dirty = 0;
+}
+
+void rtc_begin_update(void)
+{
+	s_update_depth++;
+}
+
+void rtc_end_update(void)
+{
+	if (s_update_depth) s_update_depth--;
+	rtc_flush_shadow();
+}
+
 void rtc_init(void)
 {
 	// Attempt autodetection:
@@ -129,13 +240,17 @@ void rtc_init(void)
 
 	if (rtc_read_byte(0x11) == 0xee && rtc_read_byte(0x12) == 0xdd) {
 		s_is_ds1307 = true;
+		s_is_ds3231 = false;
 		// restore values
 		rtc_write_byte(temp1, 0x11);
 		rtc_write_byte(temp2, 0x12);
 	}
 	else {
+		s_is_ds1307 = false;
 		s_is_ds3231 = true;
 	}
+
+	rtc_reload_shadow();
 }
 
 // Autodetection
@@ -143,84 +258,813 @@ bool rtc_is_ds1307(void) { return s_is_ds1307; }
 bool rtc_is_ds3231(void) { return s_is_ds3231; }
 
 // Autodetection override
-void rtc_set_ds1307(void) { s_is_ds1307 = true;   s_is_ds3231 = false; }
-void rtc_set_ds3231(void) { s_is_ds1307 = false;  s_is_ds3231 = true;  }
+void rtc_set_ds1307(void) { s_is_ds1307 = true;   s_is_ds3231 = false; rtc_reload_shadow(); }
+void rtc_set_ds3231(void) { s_is_ds1307 = false;  s_is_ds3231 = true;  rtc_reload_shadow(); }
+
+static void rtc_update_12h(struct tm* t)
+{
+	if (t->hour == 0) {
+		t->twelveHour = 0;
+		t->am = 1;
+	} else if (t->hour < 12) {
+		t->twelveHour = t->hour;
+		t->am = 1;
+	} else {
+		t->twelveHour = t->hour - 12;
+		t->am = 0;
+	}
+}
+
+// Packed BCD decode of four register bytes at once. A BCD byte 16*h + l is
+// 10*h + l == b - 6*h, and since b >= 6*h no lane ever borrows from the next.
+static inline uint32_t bcd2dec_4(uint32_t b)
+{
+	return b - 6 * ((b >> 4) & 0x0F0F0F0FUL);
+}
+
+// Register bits that are not part of the value: CH (sec), 12/24 (hour) and
+// century (month) are cleared in the same pass as the decode
+#define TIME_MASK_LO 0x073F7F7FUL // wday, hour, min, sec
+#define TIME_MASK_HI 0x00FF1F3FUL // -, year, month, mday
+
+static inline uint32_t rtc_load_4(const uint8_t* p)
+{
+	return p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// decode the 7 time registers into _tm
+static void rtc_decode_time(const uint8_t* rtc)
+{
+	// only 7 registers: the fourth byte of the high word stays zero
+	uint32_t hi = rtc[4] | ((uint16_t)rtc[5] << 8) | ((uint32_t)rtc[6] << 16);
+	uint32_t lo = bcd2dec_4(rtc_load_4(rtc) & TIME_MASK_LO);
+	uint8_t year;
+
+	hi = bcd2dec_4(hi & TIME_MASK_HI);
+	year = hi >> 16; // year 0-99
+
+	// struct tm fields are int: take one byte lane each
+	_tm.sec = (uint8_t)lo;
+	_tm.min = (uint8_t)(lo >> 8);
+	_tm.hour = (uint8_t)(lo >> 16);
+	_tm.wday = (uint8_t)(lo >> 24); // returns 1-7
+	_tm.mday = (uint8_t)hi;
+	_tm.mon = (uint8_t)(hi >> 8); // returns 1-12
+	_tm.year = (rtc[5] & 0x80) ? 2000 + year : 1900 + year;
+
+	rtc_update_12h(&_tm);
+}
+
+// Software clock
+//
+// Keeps a copy of the time in RAM and advances it on every falling edge of the
+// 1Hz square wave (DS1307 SQW/OUT, DS3231 INT/SQW), which is when the chip
+// updates its seconds register. rtc_get_time and rtc_get_time_s serve the
+// copy and only go to the bus to resync.
+static volatile bool s_soft_clock;
+static volatile bool s_soft_edge;   // an edge was seen since this was cleared
+static bool s_soft_valid;
+static volatile uint16_t s_soft_ticks; // edges since the last resync
+static uint16_t s_soft_resync;
+static struct tm s_soft_tm;
+
+static const uint8_t s_month_days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+// runs from the external interrupt
+static void rtc_soft_tick(void)
+{
+	struct tm* t = &s_soft_tm;
+	uint8_t mdays;
+
+	s_soft_edge = true;
+	if (s_soft_ticks != 0xFFFF) s_soft_ticks++;
+
+	if (++t->sec < 60) return;
+	t->sec = 0;
+	if (++t->min < 60) return;
+	t->min = 0;
+	if (++t->hour < 24) return;
+	t->hour = 0;
+	if (++t->wday > 7) t->wday = 1;
+
+	mdays = s_month_days[t->mon - 1];
+	if (t->mon == 2 && (t->year & 3) == 0) mdays = 29; // good for 1901-2099
+	if (++t->mday <= mdays) return;
+	t->mday = 1;
+	if (++t->mon <= 12) return;
+	t->mon = 1;
+	t->year++;
+}
+
+// Read the time from the chip into the software clock. A read that was
+// overlapped by an edge may or may not include it, so it is repeated.
+static void rtc_soft_sync(void)
+{
+	uint8_t rtc[7];
+	bool synced = false;
+
+	while (!synced) {
+		s_soft_edge = false;
+		rtc_read_block(0x0, rtc, 7);
+		rtc_decode_time(rtc);
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (!s_soft_edge) {
+				s_soft_tm = _tm;
+				s_soft_ticks = 0;
+				synced = true;
+			}
+		}
+	}
+
+	s_soft_valid = true;
+}
+
+// true when the software clock can be served without going to the bus
+static bool rtc_soft_current(void)
+{
+	if (!s_soft_clock) return false;
+
+	// the time now comes from RAM, not the registers: rtc_adjust_time mustn't
+	// diff against what they held when last read (a resync below refills it)
+	s_time_known = 0;
+
+	if (!s_soft_valid || (s_soft_resync && s_soft_ticks >= s_soft_resync))
+		rtc_soft_sync();
+
+	return true;
+}
+
+// Alarm interrupt
+//
+// DS3231: INT/SQW goes low when alarm 1 matches and stays low until A1F is
+// cleared. The external interrupt queues the write that clears it, and the
+// user handler runs once that is done, so the bus is only used when the
+// alarm goes off.
+// DS1307: the alarm engine below counts down on the square wave and calls
+// the handler from the external interrupt.
+static volatile bool s_alarm_int;
+static volatile bool s_alarm_fired; // for rtc_check_alarm
+static void (*s_alarm_handler)(void);
+static void (*s_alarm_direct)(void); // rtc_alarm_int_attach
+static twi_xfer_t s_alarm_xfer;
+static uint8_t s_alarm_clear[2];
+
+// DS1307 alarm engine
+//
+// The DS1307 has no alarm: the alarm is kept in SRAM bytes 0 to 4 (hour,
+// minute, second, mode, day) and cached here. Once armed from a read of the
+// time, the engine counts down to the next match, so a match is reported
+// exactly once even when the polls miss the matching second. The count runs
+// on the 1Hz square wave when the alarm interrupt is on (re-armed from a
+// queued read of the chip every RTC_ALARM_RESYNC seconds), otherwise on the
+// time each rtc_check_alarm reads, which must come at least once a day.
+#define SECS_PER_DAY 86400UL
+#ifndef RTC_ALARM_RESYNC
+#define RTC_ALARM_RESYNC 3600
+#endif
+
+static bool s_alarm_cached;             // the fields below match SRAM
+static uint32_t s_alarm_secs;           // hour:min:sec as seconds of the day
+static uint8_t s_alarm_mode;
+static uint8_t s_alarm_day;             // day of week or date
+static uint8_t s_alarm_mon;             // monthly: month and year of the next match
+static uint8_t s_alarm_year;
+static uint32_t s_alarm_period;         // seconds between matches, 0: monthly
+static volatile bool s_alarm_armed;     // the fields below are valid
+static volatile uint32_t s_alarm_left;  // seconds to the next match
+static uint32_t s_alarm_last;           // time of day of the last poll
+static volatile uint16_t s_alarm_ticks; // square wave edges since arming
+static struct rtc_xfer s_alarm_sync;
+static uint8_t s_alarm_sync_regs[7];
+static uint16_t s_alarm_sync_ticks;     // s_alarm_ticks when the read was queued
+
+static uint32_t rtc_secs_of_day(uint8_t hour, uint8_t min, uint8_t sec)
+{
+	return hour * 3600UL + min * 60U + sec;
+}
+
+// time of day in registers 0 to 2: 24-hour mode only
+static uint32_t rtc_decode_secs(const uint8_t* rtc)
+{
+	uint32_t t = bcd2dec_4((rtc[0] | (rtc[1] << 8) | ((uint32_t)rtc[2] << 16)) & TIME_MASK_LO);
+	return rtc_secs_of_day((uint8_t)(t >> 16), (uint8_t)(t >> 8), (uint8_t)t);
+}
+
+// time registers needed to arm: the weekly and monthly alarms need the day
+// of week (register 3) or the date (registers 4 to 6)
+static uint8_t rtc_alarm_regs(void)
+{
+	if (s_alarm_mode == ALARM_MONTHLY) return 7;
+	if (s_alarm_mode == ALARM_WEEKLY) return 4;
+	return 3;
+}
+
+// Monthly: days from date mday of s_alarm_mon to the next month that has
+// the date, which becomes s_alarm_mon
+static uint16_t rtc_alarm_next_month(uint8_t mday)
+{
+	uint8_t mon = s_alarm_mon, year = s_alarm_year, mdays;
+	uint16_t days = 0;
+
+	for (;;) {
+		mdays = s_month_days[mon - 1];
+		if (mon == 2 && (year & 3) == 0) mdays = 29;
+		if (s_alarm_day > mday && s_alarm_day <= mdays) break;
+
+		days += mdays - mday;
+		mday = 0;
+		if (++mon > 12) {
+			mon = 1;
+			year++;
+		}
+	}
+	s_alarm_mon = mon;
+	s_alarm_year = year;
+
+	return days + s_alarm_day - mday;
+}
+
+// Seconds from the time in rtc to the next match, never 0. *match is set
+// when the current second matches.
+static uint32_t rtc_alarm_until(const uint8_t* rtc, bool* match)
+{
+	uint32_t now = rtc_decode_secs(rtc);
+	uint32_t alarm = s_alarm_secs;
+	uint32_t left;
+	uint8_t mday;
+
+	if (s_alarm_period) {
+		// position within the period: of the minute, hour, day or week
+		if (s_alarm_mode == ALARM_WEEKLY) {
+			now += (((rtc[3] & 0x07) ? rtc[3] & 0x07 : 1) - 1) * SECS_PER_DAY;
+			alarm += (s_alarm_day - 1) * SECS_PER_DAY;
+		}
+		now %= s_alarm_period;
+		alarm %= s_alarm_period;
+
+		left = (alarm + s_alarm_period - now) % s_alarm_period;
+		*match = !left;
+		return left ? left : s_alarm_period;
+	}
+
+	// monthly: count the days to the next month that has the date
+	mday = bcd2dec(rtc[4] & 0x3F);
+	s_alarm_mon = bcd2dec(rtc[5] & 0x1F);
+	s_alarm_year = bcd2dec(rtc[6]);
+	if (s_alarm_mon < 1 || s_alarm_mon > 12) s_alarm_mon = 1;
+
+	*match = mday == s_alarm_day && now == alarm;
+	if (mday == s_alarm_day && now < alarm) return alarm - now;
+
+	return rtc_alarm_next_month(mday) * SECS_PER_DAY + alarm - now;
+}
+
+// the alarm as stored in SRAM
+static void rtc_alarm_cache(const uint8_t* alarm)
+{
+	static const uint32_t periods[] = { SECS_PER_DAY, 1, 60, 3600, 7 * SECS_PER_DAY, 0 };
+
+	s_alarm_secs = rtc_secs_of_day(alarm[0], alarm[1], alarm[2]);
+	s_alarm_mode = alarm[3] <= ALARM_MONTHLY ? alarm[3] : ALARM_DAILY;
+	s_alarm_day = alarm[4];
+	if ((s_alarm_mode == ALARM_WEEKLY && (s_alarm_day < 1 || s_alarm_day > 7)) ||
+	    (s_alarm_mode == ALARM_MONTHLY && (s_alarm_day < 1 || s_alarm_day > 31)))
+		s_alarm_mode = ALARM_DAILY;
+	s_alarm_period = periods[s_alarm_mode];
+	s_alarm_cached = true;
+}
+
+static void rtc_alarm_load(void)
+{
+	uint8_t alarm[5];
+
+	if (s_alarm_cached) return;
+
+	rtc_read_block(DS1307_SRAM_ADDR, alarm, 5);
+	rtc_alarm_cache(alarm);
+	s_alarm_armed = false;
+}
+
+// Start counting at the time in rtc. With catch_up, a match in the current
+// second fires: a poll may be the first to look at it.
+static void rtc_alarm_start(const uint8_t* rtc, bool catch_up)
+{
+	bool match;
+	uint32_t left = rtc_alarm_until(rtc, &match);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		s_alarm_left = left;
+		s_alarm_last = rtc_decode_secs(rtc);
+		s_alarm_ticks = 0;
+		s_alarm_armed = true;
+	}
+
+	if (catch_up && match) s_alarm_fired = true;
+}
+
+// Start counting from the chip's time. A read that was overlapped by an
+// edge is repeated.
+static void rtc_alarm_arm(bool catch_up)
+{
+	uint8_t rtc[7];
+	uint16_t ticks;
+
+	rtc_alarm_load();
+
+	do {
+		ticks = s_alarm_ticks;
+		rtc_read_block(0x0, rtc, rtc_alarm_regs());
+	} while (ticks != s_alarm_ticks);
+
+	rtc_alarm_start(rtc, catch_up);
+}
+
+// a write to the time registers or the alarm bytes: count again
+static void rtc_alarm_written(uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	if (!s_is_ds1307) return;
+
+	if (reg < DS1307_SRAM_ADDR + 5 && reg + len > DS1307_SRAM_ADDR) {
+		s_alarm_cached = false;
+	}
+	else if (reg == 0x0 && s_alarm_cached && len >= rtc_alarm_regs()) {
+		// the time that was just written: nothing to read. As on the
+		// DS3231, the new time itself doesn't match.
+		rtc_alarm_start(buf, false);
+		return;
+	}
+	else if (reg >= 0x07) {
+		return;
+	}
+
+	s_alarm_armed = false;
+	if (s_alarm_int) rtc_alarm_arm(true);
+}
+
+// A new alarm, already written to SRAM. As on the DS3231 an alarm that
+// went off before is dropped, and the current second doesn't match.
+static void rtc_alarm_changed(const uint8_t* alarm)
+{
+	rtc_alarm_cache(alarm);
+	s_alarm_fired = false;
+	rtc_alarm_arm(false);
+}
+
+// runs from the TWI interrupt
+static void rtc_alarm_synced(twi_xfer_t* x)
+{
+	// an edge since the read was queued would be counted twice: the next
+	// one tries again
+	if (x->status != TWI_XFER_DONE || !s_alarm_armed || s_alarm_ticks != s_alarm_sync_ticks)
+		return;
+
+	rtc_time_seen(0x0, s_alarm_sync_regs, rtc_alarm_regs());
+	rtc_alarm_start(s_alarm_sync_regs, false);
+}
+
+// runs from the external interrupt, on each square wave edge
+static void rtc_alarm_tick(void)
+{
+	if (s_alarm_ticks != 0xFFFF) s_alarm_ticks++;
+
+	if (!s_alarm_armed) return;
+
+	if (!--s_alarm_left) {
+		s_alarm_left = s_alarm_period;
+		if (!s_alarm_left) {
+			// monthly: this is the date, on to the next month that has it
+			s_alarm_left = rtc_alarm_next_month(s_alarm_day) * SECS_PER_DAY;
+		}
+		s_alarm_fired = true;
+		if (s_alarm_handler) s_alarm_handler();
+	}
+
+	// count from the chip's time again now and then, polled or not
+	if (s_alarm_ticks >= RTC_ALARM_RESYNC && s_alarm_sync.twi.status != TWI_XFER_PENDING) {
+		s_alarm_sync_ticks = s_alarm_ticks;
+		rtc_read_block_async(&s_alarm_sync, 0x0, s_alarm_sync_regs, rtc_alarm_regs(), rtc_alarm_synced);
+	}
+}
+
+// polled: count the seconds since the last poll
+static bool rtc_alarm_poll(void)
+{
+	uint8_t rtc[7];
+	uint32_t now, elapsed;
+	bool fired, match;
+
+	if (!s_alarm_armed) {
+		rtc_alarm_arm(true);
+	}
+	else {
+		rtc_read_block(0x0, rtc, s_alarm_period ? 3 : 7);
+		now = rtc_decode_secs(rtc);
+		elapsed = (now + SECS_PER_DAY - s_alarm_last) % SECS_PER_DAY;
+		s_alarm_last = now;
+
+		if (elapsed < s_alarm_left) {
+			s_alarm_left -= elapsed;
+		}
+		else {
+			s_alarm_fired = true;
+			if (s_alarm_period)
+				s_alarm_left = s_alarm_period - (elapsed - s_alarm_left) % s_alarm_period;
+			else
+				s_alarm_left = rtc_alarm_until(rtc, &match);
+		}
+	}
+
+	fired = s_alarm_fired;
+	s_alarm_fired = false;
+	return fired;
+}
+
+// runs from the TWI interrupt
+static void rtc_alarm_cleared(twi_xfer_t* x)
+{
+	if (s_alarm_handler) s_alarm_handler();
+}
+
+// runs from the external interrupt
+static void rtc_alarm_fired(void)
+{
+	s_alarm_fired = true;
+
+	// still clearing the last one
+	if (s_alarm_xfer.status == TWI_XFER_PENDING) return;
+
+	s_alarm_clear[0] = 0x0F;
+	s_alarm_clear[1] = s_status & ~DS3231_A1F;
+	s_alarm_xfer.address = RTC_ADDR;
+	s_alarm_xfer.txData = s_alarm_clear;
+	s_alarm_xfer.txLength = 2;
+	s_alarm_xfer.rxData = 0;
+	s_alarm_xfer.rxLength = 0;
+	s_alarm_xfer.callback = rtc_alarm_cleared;
+	rtc_bus_submit(&s_alarm_xfer);
+}
+
+// DS3231: INT/SQW now carries the square wave, whose edges aren't alarms
+static void rtc_alarm_int_release(void)
+{
+	s_alarm_int = false;
+	s_alarm_direct = 0;
+}
+
+void rtc_int_handler(void)
+{
+	if (s_is_ds1307) {
+		// the square wave drives both
+		if (s_soft_clock) rtc_soft_tick();
+		if (s_alarm_int) rtc_alarm_tick();
+	}
+	else if (s_alarm_direct) s_alarm_direct();
+	else if (s_alarm_int) rtc_alarm_fired();
+	else if (s_soft_clock) rtc_soft_tick();
+}
+
+#ifndef RTC_NO_INT0
+ISR(INT0_vect)
+{
+	rtc_int_handler();
+}
+#endif
+
+static void rtc_int_attach(void)
+{
+#ifndef RTC_NO_INT0
+	// INT0 (PD2) as input with pull-up: the RTC output is open drain
+	DDRD  &= ~_BV(PD2);
+	PORTD |=  _BV(PD2);
+
+	// trigger on the falling edge
+#if defined(EICRA)
+	EICRA = (EICRA & ~(_BV(ISC01) | _BV(ISC00))) | _BV(ISC01);
+	EIFR  = _BV(INTF0);
+	EIMSK |= _BV(INT0);
+#else
+	MCUCR = (MCUCR & ~(_BV(ISC01) | _BV(ISC00))) | _BV(ISC01);
+	GIFR  = _BV(INTF0);
+	GICR |= _BV(INT0);
+#endif
+#endif
+}
+
+void rtc_soft_clock_enable(uint16_t resync_interval)
+{
+	s_soft_resync = resync_interval;
+
+	// 1Hz square wave, in one control register write
+	rtc_begin_update();
+	rtc_SQW_set_freq(FREQ_1);
+	rtc_SQW_enable(true);
+	rtc_end_update();
+
+	s_soft_clock = true;
+	rtc_int_attach();
+	rtc_soft_sync();
+}
+
+void rtc_soft_clock_disable(void)
+{
+	s_soft_clock = false;
+	s_soft_valid = false;
+}
+
+bool rtc_alarm_int_enable(void (*handler)(void))
+{
+	uint8_t regs[2];
+
+	s_alarm_handler = handler;
+	s_alarm_direct = 0;
+	s_alarm_fired = false;
+
+	if (s_is_ds1307) {
+		// count down on the 1Hz square wave, in one control register write
+		rtc_begin_update();
+		rtc_SQW_set_freq(FREQ_1);
+		rtc_SQW_enable(true);
+		rtc_end_update();
+
+		s_alarm_int = true;
+		rtc_int_attach();
+		s_alarm_armed = false;
+		rtc_alarm_arm(true);
+		return true;
+	}
+
+	rtc_soft_clock_disable();
+
+	// INTCN and A1IE, and a flag left from before cleared so that INT is
+	// released: one write covers both registers and any pending changes
+	// to them
+	s_control = (s_control & ~RTC_ALARM2) | 0b00000100 | RTC_ALARM1;
+	regs[0] = s_control;
+	regs[1] = s_status & ~DS3231_A1F;
+	rtc_write_block(0x0E, regs, 2);
+	s_dirty &= ~(SHADOW_CONTROL | SHADOW_STATUS);
+
+	s_alarm_int = true;
+	rtc_int_attach();
+	return true;
+}
+
+bool rtc_alarm_int_attach(uint8_t alarms, void (*handler)(void))
+{
+	uint8_t regs[2];
+
+	if (s_is_ds1307) return false;
+
+	rtc_soft_clock_disable();
+	s_alarm_handler = 0;
+	s_alarm_direct = handler;
+	s_alarm_fired = false;
+
+	// as rtc_alarm_int_enable, with the enables and flags of both alarms
+	s_control = (s_control & ~(RTC_ALARM1 | RTC_ALARM2)) | 0b00000100 | alarms;
+	regs[0] = s_control;
+	regs[1] = s_status & ~alarms;
+	rtc_write_block(0x0E, regs, 2);
+	s_dirty &= ~(SHADOW_CONTROL | SHADOW_STATUS);
+
+	s_alarm_int = true;
+	rtc_int_attach();
+	return true;
+}
+
+void rtc_alarm_clear(uint8_t alarms)
+{
+	rtc_write_byte(s_status & ~alarms, 0x0F);
+}
+
+void rtc_alarm_int_disable(void)
+{
+	if (!s_alarm_int) return;
+
+	s_alarm_int = false;
+	s_alarm_direct = 0;
+	if (s_is_ds1307) {
+		// rtc_check_alarm counts from its own reads again
+		s_alarm_armed = false;
+		return; // the square wave may serve the soft clock
+	}
+
+	s_control &= ~(RTC_ALARM1 | RTC_ALARM2); // A1IE, A2IE
+	s_dirty |= SHADOW_CONTROL;
+	rtc_flush_shadow();
+}
 
 struct tm* rtc_get_time(void)
 {
 	uint8_t rtc[9];
-	uint8_t century = 0;
+
+	if (rtc_soft_current()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			_tm = s_soft_tm;
+		}
+		rtc_update_12h(&_tm);
+		return &_tm;
+	}
 
 	// read 7 bytes starting from register 0
 	// sec, min, hour, day-of-week, date, month, year
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0);
-	twi_end_transmission();
+	rtc_read_block(0x0, rtc, 7);
+	rtc_decode_time(rtc);
 
-	twi_request_from(RTC_ADDR, 7);
+	return &_tm;
+}
+
+void rtc_get_time_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
+{
+	uint8_t rtc[9];
+	uint32_t t;
 
-	for (uint8_t i = 0; i < 7; i++) {
-		rtc[i] = twi_receive();
+	if (rtc_soft_current()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (sec)  *sec  = s_soft_tm.sec;
+			if (min)  *min  = s_soft_tm.min;
+			if (hour) *hour = s_soft_tm.hour;
+		}
+		return;
 	}
 
-	twi_end_transmission();
+	// read 3 bytes starting from register 0: sec, min, hour
+	rtc_read_block(0x0, rtc, 3);
+	rtc[3] = 0;
+	t = bcd2dec_4(rtc_load_4(rtc) & TIME_MASK_LO);
 
-	// Clear clock halt bit from read data
-	// This starts the clock for a DS1307, and has no effect for a DS3231
-	rtc[0] &= ~(_BV(CH_BIT)); // clear bit
+	if (sec)  *sec =  (uint8_t)t;
+	if (min)  *min =  (uint8_t)(t >> 8);
+	if (hour) *hour = (uint8_t)(t >> 16);
+}
 
-	_tm.sec = bcd2dec(rtc[0]);
-	_tm.min = bcd2dec(rtc[1]);
-	_tm.hour = bcd2dec(rtc[2]);
-	_tm.mday = bcd2dec(rtc[4]);
-	_tm.mon = bcd2dec(rtc[5] & 0x1F); // returns 1-12
-	century = (rtc[5] & 0x80) >> 7;
-	_tm.year = century == 1 ? 2000 + bcd2dec(rtc[6]) : 1900 + bcd2dec(rtc[6]); // year 0-99
-	_tm.wday = bcd2dec(rtc[3]); // returns 1-7
+// Field-selective reads: field bit n is time register n
+static const uint8_t s_field_offsets[7] = {
+	offsetof(struct tm, sec), offsetof(struct tm, min), offsetof(struct tm, hour),
+	offsetof(struct tm, wday), offsetof(struct tm, mday), offsetof(struct tm, mon),
+	offsetof(struct tm, year)
+};
+// value bits of each register, as TIME_MASK_LO and TIME_MASK_HI
+static const uint8_t s_field_masks[7] = { 0x7F, 0x7F, 0x3F, 0x07, 0x3F, 0x1F, 0xFF };
 
-	if (_tm.hour == 0) {
-		_tm.twelveHour = 0;
-		_tm.am = 1;
-	} else if (_tm.hour < 12) {
-		_tm.twelveHour = _tm.hour;
-		_tm.am = 1;
-	} else {
-		_tm.twelveHour = _tm.hour - 12;
-		_tm.am = 0;
+#define TM_FIELD(t, i) (*(int*)((uint8_t*)(t) + s_field_offsets[i]))
+
+struct tm* rtc_get_fields(uint8_t mask)
+{
+	uint8_t rtc[7];
+	uint8_t fields = mask & RTC_FIELD_ALL;
+	uint8_t regs, first, last, i;
+
+	if (mask & RTC_FIELD_12H) fields |= RTC_FIELD_HOUR;
+
+	if (rtc_soft_current()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			for (i = 0; i < 7; i++)
+				if (fields & (1 << i)) TM_FIELD(&_tm, i) = TM_FIELD(&s_soft_tm, i);
+		}
+	}
+	else if (fields) {
+		// the century bit of the year is in the month register
+		regs = fields;
+		if (fields & RTC_FIELD_YEAR) regs |= RTC_FIELD_MON;
+
+		for (first = 0; !(regs & (1 << first)); first++);
+		for (last = 6; !(regs & (1 << last)); last--);
+		rtc_read_block(first, rtc + first, last - first + 1);
+
+		for (i = first; i <= last; i++)
+			if (fields & (1 << i)) TM_FIELD(&_tm, i) = bcd2dec(rtc[i] & s_field_masks[i]);
+		if (fields & RTC_FIELD_YEAR)
+			_tm.year += (rtc[5] & 0x80) ? 2000 : 1900;
 	}
 
+	if (mask & RTC_FIELD_12H) rtc_update_12h(&_tm);
 	return &_tm;
 }
 
-void rtc_get_time_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
+// Snapshots
+//
+// The chip copies the time registers to a buffer on the START of each read,
+// so one burst always has a time and date that belong together. Other
+// registers (alarm flags, BSY) are read live, so the seconds are read once
+// more afterwards: if they moved on, the time rolled over in between and
+// everything is read again. Registers up to RTC_SNAPSHOT_BURST go in the
+// same burst as the time, others in a read of their own.
+#define RTC_SNAPSHOT_BURST 16 // through the DS3231 status register
+
+struct tm* rtc_get_snapshot(uint8_t reg, uint8_t* buf, uint8_t len)
 {
-	uint8_t rtc[9];
+	uint8_t rtc[RTC_SNAPSHOT_BURST];
+	uint8_t end = reg + len;
+	uint8_t i;
 
-	// read 7 bytes starting from register 0
-	// sec, min, hour, day-of-week, date, month, year
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0);
-	twi_end_transmission();
-	
-	twi_request_from(RTC_ADDR, 7);
-	
-	for(uint8_t i=0; i<7; i++) {
-		rtc[i] = twi_receive();
+	do {
+		if (end <= RTC_SNAPSHOT_BURST) {
+			rtc_read_block(0x0, rtc, end > 7 ? end : 7);
+			for (i = 0; i < len; i++)
+				buf[i] = rtc[reg + i];
+		}
+		else {
+			rtc_read_block(0x0, rtc, 7);
+			rtc_read_block(reg, buf, len);
+		}
+	} while (end > 7 && rtc_read_byte(0x0) != rtc[0]);
+
+	rtc_decode_time(rtc);
+	return &_tm;
+}
+
+// Epoch time
+//
+// The year register is taken as 2000-2099, with every fourth year a leap
+// year from 2000 on; the century bit is ignored. Days are counted from
+// 2000-01-01, a Saturday.
+static const uint16_t s_days_before_month[] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static uint32_t rtc_epoch(uint8_t year, uint8_t mon, uint8_t mday, uint32_t secs_of_day)
+{
+	uint16_t days;
+
+	if (mon < 1 || mon > 12) mon = 1;
+	days = 365 * year + (year + 3) / 4 + s_days_before_month[mon - 1] + mday - 1;
+	if (mon > 2 && (year & 3) == 0) days++;
+
+	return RTC_SECS_YR_2000 + days * SECS_PER_DAY + secs_of_day;
+}
+
+uint32_t rtc_get_epoch(void)
+{
+	uint8_t rtc[8];
+	uint32_t lo, hi;
+
+	if (rtc_soft_current()) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			lo = rtc_secs_of_day(s_soft_tm.hour, s_soft_tm.min, s_soft_tm.sec);
+			hi = s_soft_tm.mday | ((uint16_t)s_soft_tm.mon << 8) | ((uint32_t)(s_soft_tm.year % 100) << 16);
+		}
+		return rtc_epoch(hi >> 16, hi >> 8, hi, lo);
 	}
-	
-	twi_end_transmission();
-	
-	if (sec)  *sec =  bcd2dec(rtc[0]);
-	if (min)  *min =  bcd2dec(rtc[1]);
-	if (hour) *hour = bcd2dec(rtc[2]);
+
+	// both words decoded at once, straight from the registers
+	rtc_read_block(0x0, rtc, 7);
+	rtc[7] = 0;
+	lo = bcd2dec_4(rtc_load_4(rtc) & TIME_MASK_LO);
+	hi = bcd2dec_4(rtc_load_4(rtc + 4) & TIME_MASK_HI);
+
+	return rtc_epoch(hi >> 16, hi >> 8, hi, rtc_secs_of_day(lo >> 16, lo >> 8, lo));
+}
+
+// Asynchronous reads
+static struct rtc_xfer s_time_xfer;
+static uint8_t s_time_regs[7];
+static void (*s_time_callback)(struct tm*);
+
+bool rtc_read_block_async(struct rtc_xfer* xfer, uint8_t reg, uint8_t* buf, uint8_t len, void (*callback)(twi_xfer_t*))
+{
+	// descriptor still owned by the TWI queue
+	if (xfer->twi.status == TWI_XFER_PENDING) return false;
+
+	xfer->reg = reg;
+	xfer->twi.address = RTC_ADDR;
+	xfer->twi.txData = &xfer->reg;
+	xfer->twi.txLength = 1;
+	xfer->twi.rxData = buf;
+	xfer->twi.rxLength = len;
+	xfer->twi.callback = callback;
+
+	return rtc_bus_submit(&xfer->twi);
+}
+
+// runs from the TWI interrupt
+static void rtc_time_done(twi_xfer_t* x)
+{
+	if (x->status == TWI_XFER_DONE) {
+		rtc_time_seen(0, s_time_regs, 7);
+		rtc_decode_time(s_time_regs);
+	}
+
+	if (s_time_callback)
+		s_time_callback(x->status == TWI_XFER_DONE ? &_tm : 0);
+}
+
+bool rtc_get_time_async(void (*callback)(struct tm*))
+{
+	if (s_time_xfer.twi.status == TWI_XFER_PENDING) return false;
+
+	s_time_callback = callback;
+	return rtc_read_block_async(&s_time_xfer, 0x0, s_time_regs, 7, rtc_time_done);
+}
+
+bool rtc_get_time_async_busy(void)
+{
+	return s_time_xfer.twi.status == TWI_XFER_PENDING;
 }
 
 // fixme: support 12-hour mode for setting time
 void rtc_set_time(struct tm* tm_)
 {
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0);
-
+	uint8_t rtc[7];
 	uint8_t century;
 	if (tm_->year > 2000) {
 		century = 0x80;
@@ -231,28 +1075,102 @@ void rtc_set_time(struct tm* tm_)
 	}
 
 	// clock halt bit is 7th bit of seconds: this is always cleared to start the clock
-	twi_send_byte(dec2bcd(tm_->sec)); // seconds
-	twi_send_byte(dec2bcd(tm_->min)); // minutes
-	twi_send_byte(dec2bcd(tm_->hour)); // hours
-	twi_send_byte(dec2bcd(tm_->wday)); // day of week
-	twi_send_byte(dec2bcd(tm_->mday)); // day
-	twi_send_byte(dec2bcd(tm_->mon) + century); // month
-	twi_send_byte(dec2bcd(tm_->year)); // year
+	rtc[0] = dec2bcd(tm_->sec); // seconds
+	rtc[1] = dec2bcd(tm_->min); // minutes
+	rtc[2] = dec2bcd(tm_->hour); // hours
+	rtc[3] = dec2bcd(tm_->wday); // day of week
+	rtc[4] = dec2bcd(tm_->mday); // day
+	rtc[5] = dec2bcd(tm_->mon) + century; // month
+	rtc[6] = dec2bcd(tm_->year); // year
+
+	rtc_write_block(0x0, rtc, 7);
+
+	// the software clock picks the new time up on its next read
+	s_soft_valid = false;
+}
+
+void rtc_set_epoch(uint32_t t)
+{
+	uint8_t rtc[7];
+	uint32_t secs;
+	uint16_t days, doy;
+	uint8_t year, mon, leap;
+
+	// the registers hold 2000-01-01 to 2099-12-31
+	if (t < RTC_SECS_YR_2000) t = RTC_SECS_YR_2000;
+	if (t > RTC_SECS_YR_2100 - 1) t = RTC_SECS_YR_2100 - 1;
+	t -= RTC_SECS_YR_2000;
+	days = t / SECS_PER_DAY;
+	secs = t % SECS_PER_DAY;
+
+	// four year blocks of 1461 days, each starting with a leap year
+	year = days / 1461 * 4;
+	doy = days % 1461;
+	leap = doy < 366;
+	if (!leap) {
+		year += 1 + (doy - 366) / 365;
+		doy = (doy - 366) % 365;
+	}
+	for (mon = 11; doy < s_days_before_month[mon] + (leap && mon >= 2); mon--);
+	doy -= s_days_before_month[mon] + (leap && mon >= 2);
+
+	// clock halt bit is 7th bit of seconds: this is always cleared to start the clock
+	rtc[0] = dec2bcd(secs % 60);
+	rtc[1] = dec2bcd(secs / 60 % 60);
+	rtc[2] = dec2bcd(secs / 3600);
+	rtc[3] = (days + 6) % 7 + 1; // Sunday is 1
+	rtc[4] = dec2bcd(doy + 1);
+	rtc[5] = dec2bcd(mon + 1) | 0x80; // century, as rtc_set_time
+	rtc[6] = dec2bcd(year);
+
+	rtc_write_block(0x0, rtc, 7);
+
+	// the software clock picks the new time up on its next read
+	s_soft_valid = false;
+}
 
-	twi_end_transmission();
+void rtc_adjust_time(struct tm* tm_)
+{
+	uint8_t rtc[7];
+	uint8_t first, last;
+
+	rtc[0] = dec2bcd(tm_->sec);
+	rtc[1] = dec2bcd(tm_->min);
+	rtc[2] = dec2bcd(tm_->hour);
+	rtc[3] = dec2bcd(tm_->wday);
+	rtc[4] = dec2bcd(tm_->mday);
+	rtc[5] = dec2bcd(tm_->mon);
+	rtc[6] = dec2bcd(tm_->year % 100);
+
+	// CH and the century bit as the chip has them
+	if (s_time_known & (1 << 0)) rtc[0] |= s_time_image[0] & 0x80;
+	if (s_time_known & (1 << 5)) rtc[5] |= s_time_image[5] & 0x80;
+	else if (tm_->year >= 2000)  rtc[5] |= 0x80; // as rtc_set_time
+
+	// the registers that differ from the image, or aren't in it
+	for (first = 0; first < 7 && (s_time_known & (1 << first)) && rtc[first] == s_time_image[first]; first++);
+	if (first == 7) return;
+	for (last = 6; (s_time_known & (1 << last)) && rtc[last] == s_time_image[last]; last--);
+
+	rtc_write_block(first, rtc + first, last - first + 1);
+
+	// the software clock picks the new time up on its next read
+	s_soft_valid = false;
 }
 
 void rtc_set_time_s(uint8_t hour, uint8_t min, uint8_t sec)
 {
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0);
+	uint8_t rtc[3];
 
 	// clock halt bit is 7th bit of seconds: this is always cleared to start the clock
-	twi_send_byte(dec2bcd(sec)); // seconds
-	twi_send_byte(dec2bcd(min)); // minutes
-	twi_send_byte(dec2bcd(hour)); // hours
+	rtc[0] = dec2bcd(sec); // seconds
+	rtc[1] = dec2bcd(min); // minutes
+	rtc[2] = dec2bcd(hour); // hours
 	
-	twi_end_transmission();
+	rtc_write_block(0x0, rtc, 3);
+
+	// the software clock picks the new time up on its next read
+	s_soft_valid = false;
 }
 
 // DS1307 only (has no effect when run on DS3231)
@@ -287,217 +1205,244 @@ bool rtc_is_clock_running(void)
   return true;
 }
 
+// temp registers 0x11 and 0x12
+static void rtc_decode_temp(const uint8_t* temp, int8_t* i, uint8_t* f)
+{
+	// integer part in entire byte (in twos complement)
+	*i = temp[0];
+	// fractional part in top two bits (increments of 0.25)
+	*f = (temp[1] >> 6) * 25;
+
+	// float value can be read like so:
+	// float temp = ((((short)msb << 8) | (short)lsb) >> 6) / 4.0f;
+}
+
 void ds3231_get_temp_int(int8_t* i, uint8_t* f)
 {
-	uint8_t msb, lsb;
+	uint8_t temp[2];
 	
 	*i = 0;
 	*f = 0;
 	
 	if (s_is_ds1307) return; // only valid on DS3231
 
-	twi_begin_transmission(RTC_ADDR);
-	// temp registers 0x11 and 0x12
-	twi_send_byte(0x11);
-	twi_end_transmission();
-
-	twi_request_from(RTC_ADDR, 2);
-
-	if (twi_available()) {
-		msb = twi_receive(); // integer part (in twos complement)
-		lsb = twi_receive(); // fraction part
-    	
-		// integer part in entire byte
-		*i = msb;
-		// fractional part in top two bits (increments of 0.25)
-		*f = (lsb >> 6) * 25;
-
-		// float value can be read like so:
-		// float temp = ((((short)msb << 8) | (short)lsb) >> 6) / 4.0f;
-	}
+	rtc_read_block(0x11, temp, 2);
+	rtc_decode_temp(temp, i, f);
 }
 
 void rtc_force_temp_conversion(uint8_t block)
 {
 	if (s_is_ds1307) return; // only valid on DS3231
 
-	// read control register (0x0E)
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0E);
-	twi_end_transmission();
-
-	twi_request_from(RTC_ADDR, 1);
-	uint8_t ctrl = twi_receive();
-
-	ctrl |= 0b00100000; // Set CONV bit
-
-	// write new control register value
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0E);
-	twi_send_byte(ctrl);
-	twi_end_transmission();
+	// set CONV bit on top of the shadowed control register (0x0E)
+	// the chip clears it again, so it is not kept in the shadow
+	rtc_write_byte(s_control | 0b00100000, 0x0E);
 
 	if (!block) return;
 	
 	// Temp conversion is ready when control register becomes 0
-	do {
-		// Block until CONV is 0
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x0E);
-		twi_end_transmission();
-		twi_request_from(RTC_ADDR, 1);
-	} while ((twi_receive() & 0b00100000) != 0);
+	// Block until CONV is 0
+	while ((rtc_read_byte(0x0E) & 0b00100000) != 0)
+		;
 }
 
+// Conversion state machine
+#ifndef RTC_TEMP_POLL_MS
+#define RTC_TEMP_POLL_MS 50
+#endif
+
+static uint8_t s_temp_state;
+static uint16_t s_temp_polled; // ms of the start or the last poll
+static uint8_t s_temp[2];      // the result: 0x11 and 0x12
+static void (*s_temp_callback)(int8_t i, uint8_t f);
+
+bool rtc_temp_start(uint16_t ms, void (*callback)(int8_t i, uint8_t f))
+{
+	if (s_is_ds1307 || s_temp_state == TEMP_CONVERTING) return false;
+
+	// CONV, as rtc_force_temp_conversion
+	rtc_write_byte(s_control | 0b00100000, 0x0E);
+
+	s_temp_callback = callback;
+	s_temp_polled = ms;
+	s_temp_state = TEMP_CONVERTING;
+	return true;
+}
+
+enum RTC_TEMP_STATE rtc_temp_poll(uint16_t ms)
+{
+	uint8_t regs[5];
+	int8_t i;
+	uint8_t f;
+
+	if (s_temp_state != TEMP_CONVERTING || (uint16_t)(ms - s_temp_polled) < RTC_TEMP_POLL_MS)
+		return (enum RTC_TEMP_STATE)s_temp_state;
+	s_temp_polled = ms;
+
+	// control, status, aging offset and temperature in one read, so that
+	// the poll that sees the conversion done has the result too
+	rtc_read_block(0x0E, regs, 5);
+	if ((regs[0] & 0b00100000) || (regs[1] & 0b00000100)) // CONV, BSY
+		return TEMP_CONVERTING;
+
+	s_temp[0] = regs[3];
+	s_temp[1] = regs[4];
+	s_temp_state = TEMP_READY;
+
+	if (s_temp_callback) {
+		rtc_decode_temp(s_temp, &i, &f);
+		s_temp_callback(i, f);
+	}
+	return TEMP_READY;
+}
+
+void rtc_temp_result(int8_t* i, uint8_t* f)
+{
+	rtc_decode_temp(s_temp, i, f);
+	if (s_temp_state == TEMP_READY) s_temp_state = TEMP_IDLE;
+}
 
-#define DS1307_SRAM_ADDR 0x08
 
 // SRAM: 56 bytes from address 0x08 to 0x3f (DS1307-only)
 void rtc_get_sram(uint8_t* data)
 {
-	// cannot receive 56 bytes in one go, because of the TWI library buffer limit
-	// so just receive one at a time for simplicity
-  	for(int i=0;i<56;i++)
-		data[i] = rtc_get_sram_byte(i);
+	// one burst, straight into data
+	rtc_read_block(DS1307_SRAM_ADDR, data, 56);
 }
 
 void rtc_set_sram(uint8_t *data)
 {
-	// cannot send 56 bytes in one go, because of the TWI library buffer limit
-	// so just send one at a time for simplicity
-  	for(int i=0;i<56;i++)
-		rtc_set_sram_byte(data[i], i);
+	// split into as few bursts as the TWI library buffer allows
+	rtc_write_block(DS1307_SRAM_ADDR, data, 56);
 }
 
 uint8_t rtc_get_sram_byte(uint8_t offset)
 {
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(DS1307_SRAM_ADDR + offset);
-	twi_end_transmission();
-
-	twi_request_from(RTC_ADDR, 1);
-	return twi_receive();
+	return rtc_read_byte(DS1307_SRAM_ADDR + offset);
 }
 
 void rtc_set_sram_byte(uint8_t b, uint8_t offset)
 {
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(DS1307_SRAM_ADDR + offset);
-	twi_send_byte(b);
-	twi_end_transmission();
+	rtc_write_byte(b, DS1307_SRAM_ADDR + offset);
+}
+
+// The soft clock and the DS1307 alarm interrupt count the edges of the 1Hz
+// square wave: a control change that stops it or moves it off 1Hz turns
+// them off
+static void rtc_sqw_changed(void)
+{
+	if (s_is_ds1307 ? (s_control & 0b00010011) == 0b00010000  // SQWE, RS1-RS0
+	                : (s_control & 0b01011100) == 0b01000000) // BBSQW, RS2-RS1, INTCN
+		return;
+
+	rtc_soft_clock_disable();
+	if (s_is_ds1307) rtc_alarm_int_disable();
 }
 
 void rtc_SQW_enable(bool enable)
 {
 	if (s_is_ds1307) {
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x07);
-		twi_end_transmission();
-		
-		// read control
-   		twi_request_from(RTC_ADDR, 1);
-		uint8_t control = twi_receive();
-
 		if (enable)
-			control |=  0b00010000; // set SQWE to 1
+			s_control |=  0b00010000; // set SQWE to 1
 		else
-			control &= ~0b00010000; // set SQWE to 0
-
-		// write control back
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x07);
-		twi_send_byte(control);
-		twi_end_transmission();
-
+			s_control &= ~0b00010000; // set SQWE to 0
 	}
 	else { // DS3231
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x0E);
-		twi_end_transmission();
-		
-		// read control
-   		twi_request_from(RTC_ADDR, 1);
-		uint8_t control = twi_receive();
-
 		if (enable) {
-			control |=  0b01000000; // set BBSQW to 1
-			control &= ~0b00000100; // set INTCN to 0
+			s_control |=  0b01000000; // set BBSQW to 1
+			s_control &= ~0b00000100; // set INTCN to 0
+			rtc_alarm_int_release();
 		}
 		else {
-			control &= ~0b01000000; // set BBSQW to 0
+			s_control &= ~0b01000000; // set BBSQW to 0
 		}
-
-		// write control back
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x0E);
-		twi_send_byte(control);
-		twi_end_transmission();
 	}
+
+	rtc_sqw_changed();
+	s_dirty |= SHADOW_CONTROL;
+	rtc_flush_shadow();
 }
 
 void rtc_SQW_set_freq(enum RTC_SQW_FREQ freq)
 {
 	if (s_is_ds1307) {
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x07);
-		twi_end_transmission();
-		
-		// read control (uses bits 0 and 1)
-   		twi_request_from(RTC_ADDR, 1);
-		uint8_t control = twi_receive();
-
-		control &= ~0b00000011; // Set to 0
-		control |= freq; // Set freq bitmask
-
-		// write control back
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x07);
-		twi_send_byte(control);
-		twi_end_transmission();
-
+		// control uses bits 0 and 1
+		s_control &= ~0b00000011; // Set to 0
+		s_control |= freq; // Set freq bitmask
 	}
 	else { // DS3231
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x0E);
-		twi_end_transmission();
-		
-		// read control (uses bits 3 and 4)
-   		twi_request_from(RTC_ADDR, 1);
-		uint8_t control = twi_receive();
-
-		control &= ~0b00011000; // Set to 0
-		control |= (freq << 4); // Set freq bitmask
-
-		// write control back
-		twi_begin_transmission(RTC_ADDR);
-		twi_send_byte(0x0E);
-		twi_send_byte(control);
-		twi_end_transmission();
+		// control uses bits 3 and 4 (RS1, RS2)
+		s_control &= ~0b00011000; // Set to 0
+		s_control |= (freq << 3); // Set freq bitmask
 	}
+
+	rtc_sqw_changed();
+	s_dirty |= SHADOW_CONTROL;
+	rtc_flush_shadow();
 }
 
 void rtc_osc32kHz_enable(bool enable)
 {
 	if (!s_is_ds3231) return;
 
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0F);
-	twi_end_transmission();
-
-	// read status
-	twi_request_from(RTC_ADDR, 1);
-	uint8_t status = twi_receive();
-
 	if (enable)
-		status |= 0b00001000; // set to 1
+		s_status |= 0b00001000; // set to 1
 	else
-		status &= ~0b00001000; // Set to 0
+		s_status &= ~0b00001000; // Set to 0
 
-	// write status back
-	twi_begin_transmission(RTC_ADDR);
-	twi_send_byte(0x0F);
-	twi_send_byte(status);
-	twi_end_transmission();
+	s_dirty |= SHADOW_STATUS;
+	rtc_flush_shadow();
+}
+
+void rtc_configure(const struct rtc_config* config)
+{
+	uint8_t control, status;
+
+	if (s_is_ds1307) {
+		// OUT, SQWE, RS1-RS0
+		control = (config->out ? 0b10000000 : 0) | (config->sqw ? 0b00010000 : 0) | (config->freq & 0b00000011);
+		if (control != s_control) s_dirty |= SHADOW_CONTROL;
+		s_control = control;
+	}
+	else {
+		// EOSC as it is; BBSQW and INTCN from sqw, RS2-RS1, A2IE, A1IE
+		control = (s_control & 0b10000000) |
+			(config->sqw ? 0b01000000 : 0b00000100) |
+			((config->freq & 0b00000011) << 3) |
+			(config->alarm_int & (RTC_ALARM1 | RTC_ALARM2));
+		status = (s_status & ~0b00001000) | (config->osc32khz ? 0b00001000 : 0);
+		if (config->sqw) rtc_alarm_int_release();
+
+		if (control != s_control)       s_dirty |= SHADOW_CONTROL;
+		if (status != s_status)         s_dirty |= SHADOW_STATUS;
+		if (config->aging != s_aging)   s_dirty |= SHADOW_AGING;
+		s_control = control;
+		s_status = status;
+		s_aging = config->aging;
+	}
+
+	rtc_sqw_changed();
+	rtc_flush_shadow();
+}
+
+void rtc_get_config(struct rtc_config* config)
+{
+	if (s_is_ds1307) {
+		config->sqw = s_control & 0b00010000;
+		config->freq = (enum RTC_SQW_FREQ)(s_control & 0b00000011);
+		config->out = s_control & 0b10000000;
+		config->alarm_int = 0;
+		config->osc32khz = false;
+		config->aging = 0;
+	}
+	else {
+		config->sqw = !(s_control & 0b00000100);
+		config->freq = (enum RTC_SQW_FREQ)((s_control >> 3) & 0b00000011);
+		config->out = false;
+		config->alarm_int = s_control & (RTC_ALARM1 | RTC_ALARM2);
+		config->osc32khz = s_status & 0b00001000;
+		config->aging = s_aging;
+	}
 }
 
 // Alarm functionality
@@ -505,48 +1450,63 @@ void rtc_osc32kHz_enable(bool enable)
 // at 00:00:00. Currently, "alarm disabled" only works for ds3231
 void rtc_reset_alarm(void)
 {
+	uint8_t alarm[5] = { 0, 0, 0, 0, 0 };
+
 	if (s_is_ds1307) {
-		rtc_set_sram_byte(0, 0); // hour
-		rtc_set_sram_byte(0, 1); // minute
-		rtc_set_sram_byte(0, 2); // second
+		// hour, minute, second, mode (daily), day
+		rtc_bus_write(RTC_ADDR, DS1307_SRAM_ADDR, alarm, 5);
+		rtc_alarm_changed(alarm);
 	}
 	else {
 		// writing 0 to bit 7 of all four alarm 1 registers disables alarm
-		rtc_write_byte(0, 0x07); // second
-		rtc_write_byte(0, 0x08); // minute
-		rtc_write_byte(0, 0x09); // hour
-		rtc_write_byte(0, 0x0a); // day
+		// second, minute, hour, day
+		rtc_write_block(0x07, alarm, 4);
 	}
 }
 
 // fixme: add an option to set whether or not the INTCN and Interrupt Enable flag is set when setting the alarm
 void rtc_set_alarm_s(uint8_t hour, uint8_t min, uint8_t sec)
 {
+	rtc_set_alarm_mode(ALARM_DAILY, 0, hour, min, sec);
+}
+
+void rtc_set_alarm_mode(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+	// A1M4-A1M1 for each mode
+	static const uint8_t masks[] = { 0b1000, 0b1111, 0b1110, 0b1100, 0b0000, 0b0000 };
+	uint8_t m;
+
 	if (hour > 23) return;
 	if (min > 59) return;
 	if (sec > 59) return;
+	if (mode > ALARM_MONTHLY) return;
+	if (mode == ALARM_WEEKLY && (day < 1 || day > 7)) return;
+	if (mode == ALARM_MONTHLY && (day < 1 || day > 31)) return;
 
 	if (s_is_ds1307) {
-		rtc_set_sram_byte(hour, 0); // hour
-		rtc_set_sram_byte(min,  1); // minute
-		rtc_set_sram_byte(sec,  2); // second
+		uint8_t alarm[5] = { hour, min, sec, mode, day };
+		rtc_bus_write(RTC_ADDR, DS1307_SRAM_ADDR, alarm, 5);
+		rtc_alarm_changed(alarm);
 	}
 	else {
 		/*
-		 *  07h: A1M1:0  Alarm 1 seconds
-		 *  08h: A1M2:0  Alarm 1 minutes
-		 *  09h: A1M3:0  Alarm 1 hour (bit6 is am/pm flag in 12h mode)
-		 *  0ah: A1M4:1  Alarm 1 day/date (bit6: 1 for day, 0 for date)
-		 *  Sets alarm to fire when hour, minute and second matches
+		 *  07h: A1M1  Alarm 1 seconds
+		 *  08h: A1M2  Alarm 1 minutes
+		 *  09h: A1M3  Alarm 1 hour (bit6 is am/pm flag in 12h mode)
+		 *  0ah: A1M4  Alarm 1 day/date (bit6: 1 for day, 0 for date)
+		 *  A field takes part in the match when its mask bit (bit 7) is 0
 		 */
-		rtc_write_byte(dec2bcd(sec),  0x07); // second
-		rtc_write_byte(dec2bcd(min),  0x08); // minute
-		rtc_write_byte(dec2bcd(hour), 0x09); // hour
-		rtc_write_byte(0b10000001,         0x0a); // day (upper bit must be set)
+		uint8_t alarm[4];
+		m = masks[mode];
+		alarm[0] = dec2bcd(sec)  | (m & 0b0001 ? 0x80 : 0); // second
+		alarm[1] = dec2bcd(min)  | (m & 0b0010 ? 0x80 : 0); // minute
+		alarm[2] = dec2bcd(hour) | (m & 0b0100 ? 0x80 : 0); // hour
+		alarm[3] = dec2bcd(day ? day : 1) | (m & 0b1000 ? 0x80 : 0) |
+			(mode == ALARM_WEEKLY ? 0x40 : 0);                // day or date
+		rtc_write_block(0x07, alarm, 4);
 
 		// clear alarm flag
-		uint8_t val = rtc_read_byte(0x0f);
-		rtc_write_byte(val & ~0b00000001, 0x0f);
+		rtc_write_byte(s_status & ~0b00000001, 0x0f);
 	}
 }
 
@@ -558,15 +1518,46 @@ void rtc_set_alarm(struct tm* tm_)
 
 void rtc_get_alarm_s(uint8_t* hour, uint8_t* min, uint8_t* sec)
 {
+	uint8_t alarm[3];
+
 	if (s_is_ds1307) {
-		if (hour) *hour = rtc_get_sram_byte(0);
-		if (min)  *min  = rtc_get_sram_byte(1);
-		if (sec)  *sec  = rtc_get_sram_byte(2);
+		uint32_t secs;
+
+		rtc_alarm_load();
+		secs = s_alarm_secs;
+		if (hour) *hour = secs / 3600;
+		if (min)  *min  = secs / 60 % 60;
+		if (sec)  *sec  = secs % 60;
 	}
 	else {
-		*sec  = bcd2dec(rtc_read_byte(0x07) & ~0b10000000);
-		*min  = bcd2dec(rtc_read_byte(0x08) & ~0b10000000);
-		*hour = bcd2dec(rtc_read_byte(0x09) & ~0b10000000);
+		rtc_read_block(0x07, alarm, 3);
+		if (sec)  *sec  = bcd2dec(alarm[0] & ~0b10000000);
+		if (min)  *min  = bcd2dec(alarm[1] & ~0b10000000);
+		if (hour) *hour = bcd2dec(alarm[2] & ~0b10000000);
+	}
+}
+
+enum RTC_ALARM_MODE rtc_get_alarm_mode(uint8_t* day)
+{
+	uint8_t alarm[4];
+	uint8_t m;
+
+	if (s_is_ds1307) {
+		rtc_alarm_load();
+		if (day) *day = s_alarm_day;
+		return (enum RTC_ALARM_MODE)s_alarm_mode;
+	}
+
+	rtc_read_block(0x07, alarm, 4);
+	if (day) *day = bcd2dec(alarm[3] & 0x3F);
+
+	m = (alarm[0] >> 7) | ((alarm[1] >> 6) & 0b0010) | ((alarm[2] >> 5) & 0b0100) | ((alarm[3] >> 4) & 0b1000);
+	switch (m) {
+	case 0b1111: return ALARM_EVERY_SECOND;
+	case 0b1110: return ALARM_EVERY_MINUTE;
+	case 0b1100: return ALARM_HOURLY;
+	case 0b0000: return (alarm[3] & 0x40) ? ALARM_WEEKLY : ALARM_MONTHLY;
+	default:     return ALARM_DAILY;
 	}
 }
 
@@ -583,17 +1574,22 @@ struct tm* rtc_get_alarm(void)
 
 bool rtc_check_alarm(void)
 {
-	if (s_is_ds1307) {
-		uint8_t hour = rtc_get_sram_byte(0);
-		uint8_t min  = rtc_get_sram_byte(1);
-		uint8_t sec  = rtc_get_sram_byte(2);
+	if (s_is_ds1307 && !s_alarm_int)
+		return rtc_alarm_poll();
+
+	if (s_alarm_int) {
+		bool fired;
 
-		uint8_t cur_hour, cur_min, cur_sec;
-		rtc_get_time_s(&cur_hour, &cur_min, &cur_sec);
-		
-		if (cur_hour == hour && cur_min == min && cur_sec == sec)
-			return true;
-		return false;
+		// DS1307: count from the chip's time again now and then
+		if (s_is_ds1307 && (!s_alarm_armed || s_alarm_ticks >= RTC_ALARM_RESYNC))
+			rtc_alarm_arm(!s_alarm_armed);
+
+		// the interrupt has seen the alarm (and cleared the DS3231 flag)
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			fired = s_alarm_fired;
+			s_alarm_fired = false;
+		}
+		return fired;
 	}
 	else {
 		// Alarm 1 flag (A1F) in bit 0
@@ -601,7 +1597,7 @@ bool rtc_check_alarm(void)
 
 		// clear flag when set
 		if (val & 1)
-			rtc_write_byte(val & ~0b00000001, 0x0f);
+			rtc_write_byte(s_status & ~0b00000001, 0x0f);
 			
 		return val & 1 ? 1 : 0;
 	}
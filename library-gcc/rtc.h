@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include "twi.h"
+#include "twi-lowlevel.h"
 
 #define DS1307_SLAVE_ADDR 0b11010000
 
@@ -58,6 +59,16 @@ extern struct tm _tm;
 // Initialize the RTC and autodetect type (DS1307 or DS3231)
 void rtc_init(void);
 
+// BCD conversion of register values
+uint8_t dec2bcd(uint8_t d);
+uint8_t bcd2dec(uint8_t b);
+
+// Register block access through the transport (rtc-transport.h): reads are a
+// single burst straight into buf, writes are split into as few bursts as the
+// transport allows (BUFFER_LENGTH with twi.c)
+void rtc_read_block(uint8_t reg, uint8_t* buf, uint8_t len);
+void rtc_write_block(uint8_t reg, uint8_t* buf, uint8_t len);
+
 // Autodetection
 bool rtc_is_ds1307(void);
 bool rtc_is_ds3231(void);
@@ -70,11 +81,74 @@ void rtc_set_ds3231(void);
 struct tm* rtc_get_time(void);
 // Gets the time: 24-hour mode only
 void rtc_get_time_s(uint8_t* hour, uint8_t* min, uint8_t* sec);
+// Gets only the fields in mask into _tm, leaving the others as they were.
+// One burst covers the registers from the first field to the last: the
+// seconds alone are 1 byte, RTC_FIELD_DATE 3 bytes from 04h. The year also
+// reads the month register, for the century bit.
+#define RTC_FIELD_SEC  0b00000001
+#define RTC_FIELD_MIN  0b00000010
+#define RTC_FIELD_HOUR 0b00000100
+#define RTC_FIELD_WDAY 0b00001000
+#define RTC_FIELD_MDAY 0b00010000
+#define RTC_FIELD_MON  0b00100000
+#define RTC_FIELD_YEAR 0b01000000
+#define RTC_FIELD_12H  0b10000000 // am and twelveHour, from the hour
+#define RTC_FIELD_TIME (RTC_FIELD_SEC | RTC_FIELD_MIN | RTC_FIELD_HOUR)
+#define RTC_FIELD_DATE (RTC_FIELD_MDAY | RTC_FIELD_MON | RTC_FIELD_YEAR)
+#define RTC_FIELD_ALL  0b01111111
+struct tm* rtc_get_fields(uint8_t mask);
+// Gets the time into _tm and len registers from reg into buf, all as of the
+// same second. Up to register 0Fh this is one burst from register 0, further
+// registers are read separately. Registers past the time are followed by a
+// read of the seconds, and the whole read is repeated if they changed
+// meanwhile. Always reads the chip, even with the software clock running.
+struct tm* rtc_get_snapshot(uint8_t reg, uint8_t* buf, uint8_t len);
+// Seconds since 1970-01-01, decoded straight from the registers without
+// going through _tm. Subtract RTC_SECS_YR_2000 for seconds since 2000. The
+// chip's years are taken as 2000-2099.
+#define RTC_SECS_YR_2000 946684800UL
+#define RTC_SECS_YR_2100 4102444800UL
+uint32_t rtc_get_epoch(void);
+// Asynchronous reads: queued on the TWI interrupt, these return immediately.
+// Callbacks run in interrupt context once the transfer has finished.
+struct rtc_xfer {
+	twi_xfer_t twi; // twi.status can be polled
+	uint8_t reg;
+};
+// Reads len registers from reg into buf; xfer and buf must stay valid until done
+bool rtc_read_block_async(struct rtc_xfer* xfer, uint8_t reg, uint8_t* buf, uint8_t len, void (*callback)(twi_xfer_t*));
+// Reads the time into the statically allocated _tm; callback receives NULL on bus error
+bool rtc_get_time_async(void (*callback)(struct tm*));
+bool rtc_get_time_async_busy(void);
 // Sets the time: Supports both 24-hour and 12-hour mode
 void rtc_set_time(struct tm* tm_);
+// Sets the time from seconds since 1970, 2000-01-01 to 2099-12-31; times
+// outside that are clamped to it
+void rtc_set_epoch(uint32_t t);
+// Sets the time, writing only the registers from the first that differs from
+// what the library last read or wrote to the last: a seconds correction is a
+// 1 byte write. Fields that are left out are taken to still hold on the
+// chip, so read the time, correct it and adjust it before the clock carries
+// into a field the correction doesn't change. The clock halt and century
+// bits are kept as they are. 24-hour mode only.
+void rtc_adjust_time(struct tm* tm_);
 // Sets the time: Supports 12-hour mode only
 void rtc_set_time_s(uint8_t hour, uint8_t min, uint8_t sec);
 
+// Software clock: enables the 1Hz square wave and advances a RAM copy of the
+// time on each of its edges, so that rtc_get_time and rtc_get_time_s don't
+// touch the bus. The time is re-read from the chip every resync_interval
+// seconds (0: only after the time is set). Turning the square wave off or
+// moving it off 1Hz (rtc_SQW_enable, rtc_SQW_set_freq, rtc_configure) turns
+// the software clock off.
+//
+// The square wave output (DS1307 SQW/OUT, DS3231 INT/SQW) must be wired to
+// INT0, which the library then owns. Define RTC_NO_INT0 to keep INT0 for the
+// application, which must then call rtc_int_handler on every falling edge.
+void rtc_soft_clock_enable(uint16_t resync_interval);
+void rtc_soft_clock_disable(void);
+void rtc_int_handler(void);
+
 // start/stop clock running (DS1307 only)
 void rtc_run_clock(bool run);
 bool rtc_is_clock_running(void);
@@ -83,20 +157,59 @@ bool rtc_is_clock_running(void);
 void  ds3231_get_temp_int(int8_t* i, uint8_t* f);
 void rtc_force_temp_conversion(uint8_t block);
 
+// Temperature conversion without blocking (DS3231 only). rtc_temp_start
+// sets CONV and returns at once; it returns false on a DS1307 or while a
+// conversion is running. rtc_temp_poll, called from the main loop with a
+// free running millisecond count, reads CONV and BSY together with the
+// temperature, at most every RTC_TEMP_POLL_MS. Once both are clear the
+// result goes to callback (may be NULL) and the state is TEMP_READY until
+// rtc_temp_result takes it.
+enum RTC_TEMP_STATE { TEMP_IDLE = 0, TEMP_CONVERTING, TEMP_READY };
+bool rtc_temp_start(uint16_t ms, void (*callback)(int8_t i, uint8_t f));
+enum RTC_TEMP_STATE rtc_temp_poll(uint16_t ms);
+void rtc_temp_result(int8_t* i, uint8_t* f);
+
 // SRAM read/write DS1307 only
 void rtc_get_sram(uint8_t* data);
 void rtc_set_sram(uint8_t *data);
 uint8_t rtc_get_sram_byte(uint8_t offset);
 void rtc_set_sram_byte(uint8_t b, uint8_t offset);
 
+// Control register shadow: the control registers are read once by rtc_init
+// and kept in RAM. Configuration calls made between rtc_begin_update and
+// rtc_end_update are written back in one go by rtc_end_update.
+void rtc_begin_update(void);
+void rtc_end_update(void);
+// Re-read the control registers, if something else may have changed them
+void rtc_reload_shadow(void);
+
   // Auxillary functions
 enum RTC_SQW_FREQ { FREQ_1 = 0, FREQ_1024, FREQ_4096, FREQ_8192 };
 
+// DS3231: the square wave takes INT/SQW over, ending the alarm interrupt
 void rtc_SQW_enable(bool enable);
 void rtc_SQW_set_freq(enum RTC_SQW_FREQ freq);
 void rtc_osc32kHz_enable(bool enable);
 
+// Board configuration. rtc_configure compares it with the shadow and writes
+// what changed in one burst: DS1307 07h, DS3231 from the first of 0Eh-10h
+// that changed to the last. rtc_get_config reads the shadow.
+struct rtc_config {
+	bool sqw;                // square wave output; DS3231: BBSQW, and INTCN when off
+	                         // (on ends the alarm interrupt, as rtc_SQW_enable)
+	enum RTC_SQW_FREQ freq;
+	bool out;                // DS1307: SQW/OUT level while the square wave is off
+	uint8_t alarm_int;       // DS3231: RTC_ALARM1 | RTC_ALARM2 interrupt enables
+	bool osc32khz;           // DS3231: 32kHz output
+	int8_t aging;            // DS3231: aging offset
+};
+void rtc_configure(const struct rtc_config* config);
+void rtc_get_config(struct rtc_config* config);
+
 // Alarm functionality
+// On the DS1307 the alarm is kept in SRAM bytes 0 to 4. rtc_check_alarm
+// counts the seconds to it, so a match is reported once even if no poll
+// falls in the matching second.
 void rtc_reset_alarm(void);
 void rtc_set_alarm(struct tm* tm_);
 void rtc_set_alarm_s(uint8_t hour, uint8_t min, uint8_t sec);
@@ -104,4 +217,46 @@ struct tm* rtc_get_alarm(void);
 void rtc_get_alarm_s(uint8_t* hour, uint8_t* min, uint8_t* sec);
 bool rtc_check_alarm(void);  
 
+// Alarm modes: the fields that must match the time
+enum RTC_ALARM_MODE {
+	ALARM_DAILY = 0,    // hour, minute and second (rtc_set_alarm_s)
+	ALARM_EVERY_SECOND,
+	ALARM_EVERY_MINUTE, // second
+	ALARM_HOURLY,       // minute and second
+	ALARM_WEEKLY,       // day of week (1-7), hour, minute and second
+	ALARM_MONTHLY       // date (1-31), hour, minute and second
+};
+
+// Sets the alarm with a mode; day is the day of week or the date for the
+// weekly and monthly modes, and ignored otherwise. DS3231: the A1M1-A1M4
+// mask bits and DY/DT of alarm 1, so the chip does the matching. DS1307:
+// the mode and day go to SRAM bytes 3 and 4 and the alarm countdown
+// follows them; arming reads the day of week (weekly) or date (monthly) too.
+void rtc_set_alarm_mode(enum RTC_ALARM_MODE mode, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec);
+enum RTC_ALARM_MODE rtc_get_alarm_mode(uint8_t* day);
+
+// Alarm interrupt. DS3231: sets INTCN and A1IE so that INT/SQW goes low
+// when alarm 1 matches, which turns off the software clock. A1F is cleared
+// from the interrupt, and then handler (may be NULL) is called from the TWI
+// interrupt. DS1307: enables the 1Hz square wave and counts down to the
+// alarm on its edges; handler is called from the external interrupt. A
+// change that stops the square wave ends the interrupt, as rtc_alarm_int_disable.
+// Either way the pin is wired to INT0 as for the software clock, and
+// rtc_check_alarm reports the alarm without going to the bus.
+bool rtc_alarm_int_enable(void (*handler)(void));
+void rtc_alarm_int_disable(void);
+
+// DS3231 alarms: interrupt enable bits in control, flag bits in status
+#define RTC_ALARM1 0b00000001
+#define RTC_ALARM2 0b00000010
+
+// Interrupt on the DS3231 alarms in alarms, for code that programs the
+// alarm registers itself (rtc-sched.c): sets INTCN and the interrupt
+// enables and clears the flags, in one write. handler is called from the
+// external interrupt and nothing goes to the bus: INT/SQW stays low until
+// rtc_alarm_clear. rtc_alarm_int_disable turns it off. Returns false on a
+// DS1307.
+bool rtc_alarm_int_attach(uint8_t alarms, void (*handler)(void));
+void rtc_alarm_clear(uint8_t alarms);
+
 #endif
@@ -0,0 +1,107 @@
+/*
+ * Host stand-in for the Arduino Wire library, talking to the simulated chip.
+ */
+
+#include "Wire.h"
+#include "../rtc-sim.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire()
+: rxBufferIndex(0)
+, rxBufferLength(0)
+, txAddress(0)
+, txBufferLength(0)
+, transmitting(0)
+{}
+
+void TwoWire::begin()
+{
+  rxBufferIndex = 0;
+  rxBufferLength = 0;
+  txBufferLength = 0;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  transmitting = 1;
+  txAddress = address;
+  txBufferLength = 0;
+}
+
+void TwoWire::beginTransmission(int address)
+{
+  beginTransmission((uint8_t)address);
+}
+
+uint8_t TwoWire::endTransmission(void)
+{
+  return endTransmission((uint8_t)1);
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+  uint8_t ret = sim_bus_write(txAddress, txBuffer, txBufferLength, sendStop);
+  txBufferLength = 0;
+  transmitting = 0;
+  return ret;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop)
+{
+  if (quantity > BUFFER_LENGTH) {
+    quantity = BUFFER_LENGTH;
+  }
+  uint8_t read = quantity ? sim_bus_read(address, rxBuffer, quantity, sendStop) : 0;
+  rxBufferIndex = 0;
+  rxBufferLength = read;
+  return read;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+  return requestFrom(address, quantity, (uint8_t)1);
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity)
+{
+  return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)1);
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if (!transmitting || txBufferLength >= BUFFER_LENGTH) {
+    return 0;
+  }
+  txBuffer[txBufferLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t quantity)
+{
+  for (size_t i = 0; i < quantity; ++i) {
+    if (!write(data[i])) return i;
+  }
+  return quantity;
+}
+
+int TwoWire::available(void)
+{
+  return rxBufferLength - rxBufferIndex;
+}
+
+int TwoWire::read(void)
+{
+  if (rxBufferIndex < rxBufferLength) {
+    return rxBuffer[rxBufferIndex++];
+  }
+  return -1;
+}
+
+int TwoWire::peek(void)
+{
+  if (rxBufferIndex < rxBufferLength) {
+    return rxBuffer[rxBufferIndex];
+  }
+  return -1;
+}
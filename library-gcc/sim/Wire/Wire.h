@@ -0,0 +1,45 @@
+/*
+ * Host stand-in for the Arduino Wire library, talking to the simulated chip.
+ * Same interface and buffer size as the real one.
+ */
+
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+private:
+  uint8_t rxBuffer[BUFFER_LENGTH];
+  uint8_t rxBufferIndex;
+  uint8_t rxBufferLength;
+
+  uint8_t txAddress;
+  uint8_t txBuffer[BUFFER_LENGTH];
+  uint8_t txBufferLength;
+
+  uint8_t transmitting;
+
+public:
+  TwoWire();
+  void begin();
+  void beginTransmission(uint8_t address);
+  void beginTransmission(int address);
+  uint8_t endTransmission(void);
+  uint8_t endTransmission(uint8_t sendStop);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop);
+  uint8_t requestFrom(int address, int quantity);
+  size_t write(uint8_t data);
+  size_t write(const uint8_t* data, size_t quantity);
+  int available(void);
+  int read(void);
+  int peek(void);
+};
+
+extern TwoWire Wire;
+
+#endif
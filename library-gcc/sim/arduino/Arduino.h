@@ -0,0 +1,47 @@
+/*
+ * Host stand-in for the parts of the Arduino core that WireRtcLib uses.
+ * Pin interrupts are connected to the simulated chip's INT/SQW pin.
+ */
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+
+#include "../rtc-sim.h"
+
+typedef uint8_t byte;
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// every pin can interrupt: they are all wired to the chip
+#define digitalPinToInterrupt(p) (p)
+
+static inline void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+
+static inline void attachInterrupt(uint8_t irq, void (*isr)(void), int mode)
+{
+	(void)irq;
+	(void)mode;
+	sim_set_pin_handler(isr);
+}
+
+static inline void detachInterrupt(uint8_t irq)
+{
+	(void)irq;
+	sim_set_pin_handler(0);
+}
+
+static inline unsigned long millis(void) { return (unsigned long)(sim_now_us() / 1000); }
+static inline unsigned long micros(void) { return (unsigned long)sim_now_us(); }
+static inline void delay(unsigned long ms) { sim_advance_us(ms * 1000); }
+
+#endif
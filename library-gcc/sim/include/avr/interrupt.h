@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for <avr/interrupt.h>. The simulator calls interrupt
+ * handlers itself, from inside the bus and time functions.
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void)
+#define SIGNAL(vector) void vector(void)
+#define cli()
+#define sei()
+
+#endif
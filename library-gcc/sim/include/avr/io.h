@@ -0,0 +1,13 @@
+/*
+ * Host stand-in for <avr/io.h>, used by the simulator build (see sim/Makefile).
+ * The sources that include it only need _BV on the host.
+ */
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Host stand-in for <util/atomic.h>. Simulated interrupts only run from bus
+ * and time functions, so a block without bus access is atomic as it is.
+ */
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#define ATOMIC_BLOCK(type) for (int __done = 0; !__done; __done = 1)
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#endif
@@ -0,0 +1,434 @@
+/*
+ * DS RTC Library: host simulator for the DS1307 and DS3231
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Runs the avr-gcc library against both simulated chips and prints the bus
+ * time each call costs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../twi.h"
+#include "../rtc.h"
+#include "../rtc-sched.h"
+#include "../rtc-temp.h"
+#include "rtc-sim.h"
+
+static struct sim_stats s_stats;
+
+#define MEASURE(call) do { \
+		sim_stats_reset(); \
+		call; \
+		sim_stats_get(&s_stats); \
+		report(#call); \
+	} while (0)
+
+static void report(const char* call)
+{
+	printf("  %-40s %7lu us %4u tx %5u bytes\n", call,
+		(unsigned long)s_stats.bus_us, s_stats.transactions, s_stats.bytes);
+}
+
+static void print_time(const char* label, struct tm* t)
+{
+	printf("  %-40s %04d-%02d-%02d %02d:%02d:%02d wday %d\n", label,
+		t->year, t->mon, t->mday, t->hour, t->min, t->sec, t->wday);
+}
+
+static volatile int s_async_done;
+
+static void time_done(struct tm* t)
+{
+	s_async_done = t ? 1 : -1;
+}
+
+static volatile int s_alarm_calls;
+
+static void alarm_handler(void)
+{
+	s_alarm_calls++;
+}
+
+// alarms reported by rtc_check_alarm, polled every second
+static int count_alarms(uint32_t secs)
+{
+	int n = 0;
+
+	while (secs--) {
+		sim_advance_us(1000000);
+		if (rtc_check_alarm()) n++;
+	}
+	return n;
+}
+
+static char s_alarm_dates[40];
+
+// the date as the chip has it when the handler runs
+static void date_handler(void)
+{
+	size_t n = strlen(s_alarm_dates);
+
+	snprintf(s_alarm_dates + n, sizeof(s_alarm_dates) - n, " %02x-%02x",
+		sim_peek(5) & 0x1F, sim_peek(4));
+}
+
+// the monthly alarm by interrupt alone, with nothing polling
+static void monthly_int_demo(void)
+{
+	// Tuesday 2024-01-30 23:59:50, two months on
+	struct tm set = { 50, 59, 23, 30, 1, 2024, 3, false, 0 };
+	struct tm now = *rtc_get_time();
+	uint32_t secs;
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_MONTHLY, 31, 0, 0, 5);
+	s_alarm_dates[0] = 0;
+	rtc_alarm_int_enable(date_handler);
+	for (secs = 0; secs < 62 * 86400UL; secs++) {
+		sim_advance_us(1000000);
+		twi_sim_poll();
+	}
+	rtc_alarm_int_disable();
+	rtc_set_time(&now);
+	printf("  %-40s%s\n", "31st 00:00:05, interrupt only", s_alarm_dates);
+}
+
+static void alarm_modes_demo(void)
+{
+	// Wednesday 2024-02-28 23:59:50
+	struct tm set = { 50, 59, 23, 28, 2, 2024, 3, false, 0 };
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_EVERY_SECOND, 0, 0, 0, 0);
+	printf("  %-40s %d in 10s\n", "every second", count_alarms(10));
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_EVERY_MINUTE, 0, 0, 0, 30);
+	printf("  %-40s %d in 3min\n", "every minute at :30", count_alarms(180));
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_HOURLY, 0, 0, 0, 0);
+	printf("  %-40s %d in 2h\n", "hourly at :00:00", count_alarms(7200));
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_WEEKLY, 4, 0, 0, 5);
+	printf("  %-40s %d in 1min\n", "Thursdays 00:00:05", count_alarms(60));
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_MONTHLY, 29, 0, 0, 5);
+	printf("  %-40s %d in 1min\n", "29th 00:00:05 (leap year)", count_alarms(60));
+
+	rtc_set_time(&set);
+	rtc_set_alarm_mode(ALARM_MONTHLY, 28, 0, 0, 5);
+	printf("  %-40s %d in 1min\n", "28th 00:00:05", count_alarms(60));
+
+	monthly_int_demo();
+	rtc_set_alarm_s(0, 0, 20);
+}
+
+static int s_temp_calls;
+
+static void temp_done(int8_t i, uint8_t f)
+{
+	(void)i;
+	(void)f;
+	s_temp_calls++;
+}
+
+static uint16_t now_ms(void)
+{
+	return (uint16_t)(sim_now_us() / 1000);
+}
+
+// a conversion polled from a main loop that comes round every 10ms
+static int temp_demo(void)
+{
+	int loops = 0;
+
+	rtc_temp_start(now_ms(), temp_done);
+	do {
+		sim_advance_us(10000);
+		loops++;
+	} while (rtc_temp_poll(now_ms()) != TEMP_READY);
+
+	return loops;
+}
+
+// ten minutes of a temperature that rises by a quarter degree a minute,
+// polled every second
+static int temp_log_demo(void)
+{
+	uint16_t secs;
+	int samples = 0;
+
+	rtc_temp_log_start(0);
+	for (secs = 0; secs < 600; secs++) {
+		sim_set_temp(4 * 20 + secs / 60);
+		sim_advance_us(1000000);
+		if (rtc_temp_log_poll(secs)) samples++;
+	}
+	return samples;
+}
+
+static void print_temp(const char* label, int16_t q)
+{
+	int8_t i;
+	uint8_t f;
+
+	rtc_temp_split(q, &i, &f);
+	printf(" %s %d.%02u", label, i, f);
+}
+
+static int s_job_runs[3];
+
+static void job(uint8_t id)
+{
+	s_job_runs[id]++;
+}
+
+// two minutes of jobs on the DS3231 alarms, polled every second
+static void sched_demo(void)
+{
+	uint8_t hour, min, sec;
+	uint8_t i;
+
+	rtc_get_time_s(&hour, &min, &sec);
+	rtc_sched_add(hour, min, sec, 7, job);                              // alarm 1
+	rtc_sched_add(hour, min, 0, 60, job);                               // alarm 2
+	rtc_sched_add(hour, min + (sec + 30) / 60, (sec + 30) % 60, 0, job); // alarm 1
+	rtc_sched_start();
+
+	for (i = 0; i < 120; i++) {
+		sim_advance_us(1000000);
+		rtc_sched_run();
+	}
+
+	rtc_sched_stop();
+	for (i = 0; i < 3; i++)
+		rtc_sched_remove(i);
+}
+
+// ten seconds of snapshots a millisecond apart: the ones that a rollover
+// fell into take a second round
+static void snapshot_demo(void)
+{
+	uint64_t end = sim_now_us() + 10000000;
+	uint8_t regs[2];
+	int taken = 0, retried = 0;
+
+	while (sim_now_us() < end) {
+		sim_stats_reset();
+		rtc_get_snapshot(0x11, regs, 2);
+		sim_stats_get(&s_stats);
+		taken++;
+		if (s_stats.transactions > 3) retried++;
+		sim_advance_us(1000);
+	}
+	printf("  %-40s %d of %d\n", "snapshots retried in 10s", retried, taken);
+}
+
+static void run(enum sim_chip chip)
+{
+	struct tm set = { 50, 59, 23, 28, 2, 2024, 4, false, 0 };
+	struct tm* t;
+	uint8_t hour, min, sec;
+	uint32_t epoch;
+	struct tm adjust;
+	uint8_t sram[56];
+	int8_t ti;
+	uint8_t tf;
+	bool alarm;
+	int loops;
+	struct rtc_temp_stats stats;
+	struct rtc_config config;
+
+	printf("%s\n", chip == SIM_DS1307 ? "DS1307" : "DS3231");
+
+	sim_init(chip);
+	sim_set_pin_handler(rtc_int_handler);
+#ifdef RTC_TRANSPORT_TWI
+	twi_init_master();
+#endif
+
+	MEASURE(rtc_init());
+	printf("  %-40s %s\n", "detected", rtc_is_ds1307() ? "DS1307" : "DS3231");
+
+	MEASURE(rtc_set_time(&set));
+	MEASURE(t = rtc_get_time());
+	print_time("time", t);
+	MEASURE(rtc_get_time_s(&hour, &min, &sec));
+	MEASURE(t = rtc_get_fields(RTC_FIELD_SEC));
+	MEASURE(t = rtc_get_fields(RTC_FIELD_DATE | RTC_FIELD_12H));
+	print_time("fields", t);
+	MEASURE(t = rtc_get_snapshot(0x07, sram, 7));
+	MEASURE(t = rtc_get_snapshot(0x11, sram, 2));
+	snapshot_demo();
+
+	sim_advance_us(12000000);
+	MEASURE(t = rtc_get_time());
+	print_time("time, 12s later", t);
+
+	MEASURE(rtc_get_time_async(time_done));
+	MEASURE(twi_sim_poll());
+	printf("  %-40s %s\n", "async result", s_async_done > 0 ? "done" : "failed");
+
+	MEASURE(rtc_SQW_set_freq(FREQ_1024));
+	rtc_begin_update();
+	MEASURE(rtc_SQW_set_freq(FREQ_1));
+	MEASURE(rtc_SQW_enable(true));
+	MEASURE(rtc_end_update());
+
+	// the same configuration again costs nothing; the changes go in one write
+	rtc_get_config(&config);
+	MEASURE(rtc_configure(&config));
+	config.osc32khz = true;
+	config.aging = -3;
+	MEASURE(rtc_configure(&config));
+	rtc_reload_shadow();
+	rtc_get_config(&config);
+	printf("  %-40s sqw %d freq %d 32kHz %d aging %d\n", "configuration, reloaded",
+		config.sqw, config.freq, config.osc32khz, config.aging);
+
+	MEASURE(rtc_set_alarm_s(0, 0, 20));
+	MEASURE(alarm = rtc_check_alarm());
+	sim_advance_us(18000000);
+	MEASURE(alarm = rtc_check_alarm());
+	printf("  %-40s %s\n", "alarm at 00:00:20", alarm ? "fired" : "not fired");
+
+	// a poll that misses the matching second still reports the alarm, once
+	rtc_get_time_s(&hour, &min, &sec);
+	rtc_set_alarm_s(hour, min + (sec + 2) / 60, (sec + 2) % 60);
+	sim_advance_us(5000000);
+	MEASURE(alarm = rtc_check_alarm());
+	printf("  %-40s %s\n", "alarm, poll 3s late", alarm ? "fired" : "not fired");
+	MEASURE(alarm = rtc_check_alarm());
+	printf("  %-40s %s\n", "polled again", alarm ? "fired" : "not fired");
+
+	// the same alarm, delivered by interrupt instead of polling
+	s_alarm_calls = 0;
+	MEASURE(rtc_alarm_int_enable(alarm_handler));
+	rtc_get_time_s(&hour, &min, &sec);
+	rtc_set_alarm_s(hour, min + (sec + 5) / 60, (sec + 5) % 60);
+	sim_advance_us(3000000);
+	MEASURE(alarm = rtc_check_alarm());
+	sim_advance_us(3000000);
+	MEASURE(twi_sim_poll());
+	MEASURE(alarm = rtc_check_alarm());
+	printf("  %-40s %s, handler called %d times\n", "alarm interrupt",
+		alarm ? "fired" : "not fired", s_alarm_calls);
+	rtc_alarm_int_disable();
+
+	// DS3231: the square wave's edges aren't alarms
+	if (chip == SIM_DS3231) {
+		s_alarm_calls = 0;
+		rtc_alarm_int_enable(alarm_handler);
+		MEASURE(rtc_SQW_enable(true));
+		sim_advance_us(3000000);
+		twi_sim_poll();
+		printf("  %-40s handler called %d times\n", "square wave, 3s", s_alarm_calls);
+		rtc_SQW_enable(false);
+	}
+
+	MEASURE(rtc_set_alarm_mode(ALARM_WEEKLY, 1, 6, 0, 0));
+	MEASURE(rtc_get_alarm_mode(0));
+	alarm_modes_demo();
+
+	if (chip == SIM_DS3231) {
+		MEASURE(sched_demo());
+		printf("  %-40s %d, %d, %d\n", "scheduled runs: 7s, 1min, daily",
+			s_job_runs[0], s_job_runs[1], s_job_runs[2]);
+
+		sim_set_temp(4 * 31 + 1);
+		MEASURE(rtc_force_temp_conversion(1));
+		MEASURE(ds3231_get_temp_int(&ti, &tf));
+		printf("  %-40s %d.%02u C\n", "temperature", ti, tf);
+
+		sim_set_temp(4 * 22 + 3);
+		MEASURE(loops = temp_demo());
+		MEASURE(rtc_temp_result(&ti, &tf));
+		printf("  %-40s %d.%02u C after %d loops, callback %d\n", "temperature, polled",
+			ti, tf, loops, s_temp_calls);
+
+		MEASURE(loops = temp_log_demo());
+		MEASURE(rtc_temp_log_stats(&stats));
+		printf("  %-40s %d samples, %u kept:", "temperature log, 10min", loops, stats.count);
+		print_temp("last", stats.last);
+		print_temp("min", stats.min);
+		print_temp("max", stats.max);
+		print_temp("mean", stats.mean);
+		print_temp("ewma", stats.ewma);
+		printf("\n");
+	}
+	else {
+		MEASURE(rtc_get_sram(sram));
+		MEASURE(rtc_set_sram(sram));
+		MEASURE(rtc_get_sram_byte(10));
+	}
+
+	MEASURE(rtc_soft_clock_enable(0));
+	MEASURE(t = rtc_get_time());
+	sim_advance_us(5000000);
+	MEASURE(t = rtc_get_time());
+	print_time("soft clock, 5s later", t);
+	rtc_soft_clock_disable();
+	MEASURE(t = rtc_get_time());
+	print_time("chip", t);
+
+	// the square wave turned off under the soft clock takes it along
+	rtc_set_epoch(1709164790UL);
+	rtc_soft_clock_enable(0);
+	rtc_get_config(&config);
+	config.sqw = false;
+	MEASURE(rtc_configure(&config));
+	sim_advance_us(10000000);
+	print_time("square wave off, 10s later", rtc_get_time());
+
+	// 2024-02-28 23:59:50, then a day later
+	MEASURE(rtc_set_epoch(1709164790UL));
+	MEASURE(epoch = rtc_get_epoch());
+	print_time("epoch", rtc_get_time());
+	rtc_set_epoch(epoch + 86400);
+	print_time("a day later", rtc_get_time());
+
+	// 23:59:50: drift corrections write only what changed
+	adjust = *rtc_get_time();
+	adjust.sec -= 5;
+	MEASURE(rtc_adjust_time(&adjust));
+	adjust.min -= 1;
+	MEASURE(rtc_adjust_time(&adjust));
+	MEASURE(rtc_adjust_time(&adjust));
+	print_time("adjusted by -1:05", rtc_get_time());
+
+	// 10:05:00 read back an hour later off the soft clock, then set 2s back:
+	// the registers weren't read since, so the whole time is written
+	rtc_set_time_s(10, 5, 0);
+	rtc_soft_clock_enable(0);
+	rtc_get_time();
+	sim_advance_us(3602000000UL);
+	adjust = *rtc_get_time();
+	adjust.sec -= 2;
+	MEASURE(rtc_adjust_time(&adjust));
+	rtc_soft_clock_disable();
+	print_time("adjusted by -0:02 on the soft clock", rtc_get_time());
+}
+
+int main(void)
+{
+	printf("TWI_FREQ %ld Hz\n", (long)TWI_FREQ);
+	run(SIM_DS1307);
+	run(SIM_DS3231);
+	return 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * DS RTC Library: host simulator for the DS1307 and DS3231
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "rtc-sim.h"
+
+#define SIM_ADDR 0x68 // I2C address
+
+#define DS1307_REGS 0x40 // register pointer wraps after 3fh
+#define DS3231_REGS 0x13 // register pointer wraps after 12h
+
+// DS1307 control (07h)
+#define DS1307_SQWE   0b00010000
+#define DS1307_RS     0b00000011
+#define DS1307_CTRL   0b10010011 // writable bits
+
+// DS3231 control (0eh)
+#define DS3231_CONV   0b00100000
+#define DS3231_RS     0b00011000
+#define DS3231_INTCN  0b00000100
+#define DS3231_A2IE   0b00000010
+#define DS3231_A1IE   0b00000001
+
+// DS3231 control/status (0fh)
+#define DS3231_OSF    0b10000000
+#define DS3231_EN32   0b00001000
+#define DS3231_BSY    0b00000100
+#define DS3231_A2F    0b00000010
+#define DS3231_A1F    0b00000001
+
+#define CONV_TIME_NS 125000000ULL // typical, 200ms max
+#define SECOND_NS    1000000000ULL
+
+static enum sim_chip s_chip;
+static uint8_t s_regs[DS1307_REGS];
+static uint8_t s_ptr;
+
+static uint64_t s_now_ns;
+static uint64_t s_next_tick_ns; // next seconds register update
+static uint64_t s_conv_done_ns; // 0: no conversion running
+static uint32_t s_seconds;      // since power up, for the 64s conversion cycle
+static uint32_t s_freq = TWI_FREQ;
+
+static int16_t s_temp = 25 * 4;
+static bool s_int_low; // DS3231 INT asserted by an alarm
+static void (*s_pin_handler)(void);
+
+static uint64_t s_bus_ns;
+static bool s_bus_held; // last transfer ended without a STOP
+static struct sim_stats s_stats;
+
+static uint8_t bcd2dec(uint8_t b) { return (b >> 4) * 10 + (b & 0x0F); }
+static uint8_t dec2bcd(uint8_t d) { return ((d / 10) << 4) | (d % 10); }
+
+static uint8_t reg_count(void)
+{
+	return s_chip == SIM_DS1307 ? DS1307_REGS : DS3231_REGS;
+}
+
+// hour register (either mode) to 0-23
+static uint8_t hour_decode(uint8_t h)
+{
+	if (h & 0x40) { // 12h mode, bit 5 is PM
+		uint8_t h12 = bcd2dec(h & 0x1F);
+		return (h12 % 12) + (h & 0x20 ? 12 : 0);
+	}
+	return bcd2dec(h & 0x3F);
+}
+
+// 0-23 to an hour register, keeping the mode of the old value
+static uint8_t hour_encode(uint8_t hour, uint8_t old)
+{
+	if (old & 0x40) {
+		uint8_t h12 = hour % 12 ? hour % 12 : 12;
+		return 0x40 | (hour >= 12 ? 0x20 : 0) | dec2bcd(h12);
+	}
+	return dec2bcd(hour);
+}
+
+static void update_temp(void)
+{
+	s_regs[0x11] = (uint8_t)(s_temp >> 2);
+	s_regs[0x12] = (uint8_t)((s_temp & 3) << 6);
+}
+
+static void pin_edge(void)
+{
+	if (s_pin_handler) s_pin_handler();
+}
+
+// DS3231 INT follows the enabled alarm flags while INTCN is set
+static void update_int(void)
+{
+	uint8_t ctrl = s_regs[0x0E], status = s_regs[0x0F];
+	bool low = (ctrl & DS3231_INTCN) &&
+		(((ctrl & DS3231_A1IE) && (status & DS3231_A1F)) ||
+		 ((ctrl & DS3231_A2IE) && (status & DS3231_A2F)));
+
+	if (low && !s_int_low) pin_edge();
+	s_int_low = low;
+}
+
+// alarm register compare, field is skipped when its mask bit (bit 7) is set
+static bool alarm_field(uint8_t reg, uint8_t value)
+{
+	return (reg & 0x80) || bcd2dec(reg & 0x7F) == value;
+}
+
+static bool alarm_hour(uint8_t reg, uint8_t hour)
+{
+	return (reg & 0x80) || hour_decode(reg & 0x7F) == hour;
+}
+
+// day/date register: bit 6 selects day of week
+static bool alarm_day(uint8_t reg)
+{
+	if (reg & 0x80) return true;
+	if (reg & 0x40) return bcd2dec(reg & 0x0F) == (s_regs[3] & 0x07);
+	return bcd2dec(reg & 0x3F) == bcd2dec(s_regs[4] & 0x3F);
+}
+
+static void check_alarms(void)
+{
+	uint8_t sec = bcd2dec(s_regs[0] & 0x7F);
+	uint8_t min = bcd2dec(s_regs[1] & 0x7F);
+	uint8_t hour = hour_decode(s_regs[2]);
+
+	if (alarm_field(s_regs[0x07], sec) && alarm_field(s_regs[0x08], min) &&
+	    alarm_hour(s_regs[0x09], hour) && alarm_day(s_regs[0x0A]))
+		s_regs[0x0F] |= DS3231_A1F;
+
+	// alarm 2 has no seconds register: it fires at the top of the minute
+	if (sec == 0 && alarm_field(s_regs[0x0B], min) &&
+	    alarm_hour(s_regs[0x0C], hour) && alarm_day(s_regs[0x0D]))
+		s_regs[0x0F] |= DS3231_A2F;
+
+	update_int();
+}
+
+static const uint8_t s_month_days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+// advance the time registers by one second
+static void tick(void)
+{
+	uint8_t sec, min, hour, wday, mday, mon, year, mdays;
+	uint8_t century = s_regs[5] & 0x80;
+
+	sec = bcd2dec(s_regs[0] & 0x7F);
+	min = bcd2dec(s_regs[1] & 0x7F);
+	hour = hour_decode(s_regs[2]);
+	wday = s_regs[3] & 0x07;
+	mday = bcd2dec(s_regs[4] & 0x3F);
+	mon = bcd2dec(s_regs[5] & 0x1F);
+	year = bcd2dec(s_regs[6]);
+
+	if (++sec == 60) {
+		sec = 0;
+		if (++min == 60) {
+			min = 0;
+			if (++hour == 24) {
+				hour = 0;
+				if (++wday > 7) wday = 1;
+
+				// both chips treat every fourth year as a leap year
+				mdays = mon >= 1 && mon <= 12 ? s_month_days[mon - 1] : 31;
+				if (mon == 2 && (year & 3) == 0) mdays = 29;
+				if (++mday > mdays) {
+					mday = 1;
+					if (++mon > 12) {
+						mon = 1;
+						if (++year == 100) {
+							year = 0;
+							century ^= 0x80;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	s_regs[0] = dec2bcd(sec);
+	s_regs[1] = dec2bcd(min);
+	s_regs[2] = hour_encode(hour, s_regs[2]);
+	s_regs[3] = wday;
+	s_regs[4] = dec2bcd(mday);
+	s_regs[5] = dec2bcd(mon) | (s_chip == SIM_DS3231 ? century : 0);
+	s_regs[6] = dec2bcd(year);
+}
+
+static void second(void)
+{
+	uint8_t ctrl;
+
+	s_seconds++;
+
+	if (s_chip == SIM_DS1307) {
+		if (s_regs[0] & 0x80) return; // CH: oscillator stopped
+
+		tick();
+
+		ctrl = s_regs[0x07];
+		if ((ctrl & DS1307_SQWE) && (ctrl & DS1307_RS) == 0)
+			pin_edge();
+	}
+	else {
+		tick();
+
+		// temperature is converted every 64 seconds, with BSY set as for
+		// a conversion started with CONV
+		if ((s_seconds & 63) == 0 && !s_conv_done_ns) {
+			s_regs[0x0F] |= DS3231_BSY;
+			s_conv_done_ns = s_next_tick_ns - SECOND_NS + CONV_TIME_NS;
+		}
+		check_alarms();
+
+		ctrl = s_regs[0x0E];
+		if (!(ctrl & DS3231_INTCN) && (ctrl & DS3231_RS) == 0)
+			pin_edge();
+	}
+}
+
+static void conv_done(void)
+{
+	update_temp();
+	s_regs[0x0E] &= ~DS3231_CONV;
+	s_regs[0x0F] &= ~DS3231_BSY;
+	s_conv_done_ns = 0;
+}
+
+// run the chip up to the current time, conversions and seconds in order
+static void sync(void)
+{
+	for (;;) {
+		if (s_conv_done_ns && s_conv_done_ns <= s_now_ns && s_conv_done_ns <= s_next_tick_ns) {
+			conv_done();
+		}
+		else if (s_now_ns >= s_next_tick_ns) {
+			s_next_tick_ns += SECOND_NS;
+			second();
+		}
+		else {
+			break;
+		}
+	}
+}
+
+// bits that exist in the time registers, the rest read back as 0
+static const uint8_t s_ds1307_time_bits[] = { 0xFF, 0x7F, 0x7F, 0x07, 0x3F, 0x1F, 0xFF };
+static const uint8_t s_ds3231_time_bits[] = { 0x7F, 0x7F, 0x7F, 0x07, 0x3F, 0x9F, 0xFF };
+
+static void write_reg(uint8_t reg, uint8_t b)
+{
+	if (s_chip == SIM_DS1307) {
+		if (reg < 0x07) b &= s_ds1307_time_bits[reg];
+		if (reg == 0x07) b &= DS1307_CTRL;
+		s_regs[reg] = b;
+	}
+	else if (reg < 0x0E) {
+		if (reg < 0x07) b &= s_ds3231_time_bits[reg];
+		s_regs[reg] = b;
+	}
+	else if (reg == 0x0E) {
+		// CONV can only be set, and stays set until the conversion is done;
+		// one that runs already (the 64 second cycle) is the one it waits for
+		if ((b & DS3231_CONV) && !s_conv_done_ns) {
+			s_regs[0x0F] |= DS3231_BSY;
+			s_conv_done_ns = s_now_ns + CONV_TIME_NS;
+		}
+		if (s_regs[0x0E] & DS3231_CONV) b |= DS3231_CONV;
+		s_regs[0x0E] = b;
+		update_int();
+	}
+	else if (reg == 0x0F) {
+		// OSF, A2F and A1F are cleared by writing 0, BSY is read only
+		uint8_t status = s_regs[0x0F];
+		s_regs[0x0F] = (status & b & (DS3231_OSF | DS3231_A2F | DS3231_A1F)) |
+			(b & DS3231_EN32) | (status & DS3231_BSY);
+		update_int();
+	}
+	else if (reg == 0x10) {
+		s_regs[reg] = b;
+	}
+	// 11h, 12h: temperature is read only
+
+	// writing the seconds register resets the countdown chain
+	if (reg == 0x00) s_next_tick_ns = s_now_ns + SECOND_NS;
+}
+
+// START, address byte, len data bytes, optional STOP
+static void bus_time(uint8_t len, uint8_t sendStop)
+{
+	uint32_t bits = 1 + 9 * (1 + (uint32_t)len) + (sendStop ? 1 : 0);
+	uint64_t ns = (uint64_t)bits * 1000000000ULL / s_freq;
+
+	// a repeated start continues the transaction
+	if (!s_bus_held) s_stats.transactions++;
+	s_bus_held = !sendStop;
+
+	s_stats.starts++;
+	if (sendStop) s_stats.stops++;
+	s_stats.bytes += 1 + len;
+	s_bus_ns += ns;
+	s_now_ns += ns;
+}
+
+void sim_init(enum sim_chip chip)
+{
+	s_chip = chip;
+	memset(s_regs, 0, sizeof(s_regs));
+	s_ptr = 0;
+
+	// power up date is 01/01/00, day 1
+	s_regs[3] = 0x01;
+	s_regs[4] = 0x01;
+	s_regs[5] = 0x01;
+
+	if (chip == SIM_DS1307) {
+		s_regs[0] = 0x80; // CH: the oscillator is off until the time is set
+		s_regs[0x07] = DS1307_RS;
+	}
+	else {
+		s_regs[0x0E] = DS3231_RS | DS3231_INTCN;
+		s_regs[0x0F] = DS3231_OSF | DS3231_EN32;
+		update_temp();
+	}
+
+	s_next_tick_ns = s_now_ns + SECOND_NS;
+	s_conv_done_ns = 0;
+	s_seconds = 0;
+	s_int_low = false;
+	s_bus_held = false;
+}
+
+enum sim_chip sim_get_chip(void) { return s_chip; }
+
+void sim_set_bus_freq(uint32_t hz) { s_freq = hz; }
+
+uint8_t sim_bus_write(uint8_t address, const uint8_t* data, uint8_t len, uint8_t sendStop)
+{
+	sync();
+
+	if (address != SIM_ADDR) {
+		bus_time(0, 1);
+		sync();
+		return 2;
+	}
+
+	if (len) {
+		s_ptr = data[0] % reg_count();
+		for (uint8_t i = 1; i < len; i++) {
+			write_reg(s_ptr, data[i]);
+			s_ptr = (s_ptr + 1) % reg_count();
+		}
+	}
+
+	bus_time(len, sendStop);
+	sync();
+	return 0;
+}
+
+uint8_t sim_bus_read(uint8_t address, uint8_t* data, uint8_t len, uint8_t sendStop)
+{
+	// the chip copies the time registers when the transaction starts, so
+	// a read never sees a seconds update half way through
+	sync();
+
+	if (address != SIM_ADDR) {
+		bus_time(0, 1);
+		sync();
+		return 0;
+	}
+
+	for (uint8_t i = 0; i < len; i++) {
+		data[i] = s_regs[s_ptr];
+		s_ptr = (s_ptr + 1) % reg_count();
+	}
+
+	bus_time(len, sendStop);
+	sync();
+	return len;
+}
+
+uint64_t sim_now_us(void) { return s_now_ns / 1000; }
+
+void sim_advance_us(uint32_t us)
+{
+	s_now_ns += (uint64_t)us * 1000;
+	sync();
+}
+
+void sim_set_pin_handler(void (*handler)(void)) { s_pin_handler = handler; }
+
+void sim_set_temp(int16_t quarters) { s_temp = quarters; }
+
+uint8_t sim_peek(uint8_t reg) { return s_regs[reg % reg_count()]; }
+void sim_poke(uint8_t reg, uint8_t value) { s_regs[reg % reg_count()] = value; }
+
+void sim_stats_reset(void)
+{
+	memset(&s_stats, 0, sizeof(s_stats));
+	s_bus_ns = 0;
+}
+
+void sim_stats_get(struct sim_stats* stats)
+{
+	*stats = s_stats;
+	stats->bus_us = (uint32_t)(s_bus_ns / 1000);
+}
@@ -0,0 +1,91 @@
+/*
+ * DS RTC Library: host simulator for the DS1307 and DS3231
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Register level model of the two clock chips, for running rtc.c and
+ * WireRtcLib on a PC. twi-sim.c puts it behind the twi_* functions and
+ * Wire/Wire.cpp behind the Arduino Wire library.
+ *
+ * Time is simulated: it only moves when the bus is used (each transaction
+ * costs its bit times at the configured bus frequency) or when
+ * sim_advance_us is called. The chip counts seconds against that clock.
+ */
+
+#ifndef RTC_SIM_H
+#define RTC_SIM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TWI_FREQ
+#define TWI_FREQ 100000L
+#endif
+
+enum sim_chip { SIM_DS1307, SIM_DS3231 };
+
+// Bus usage since the last sim_stats_reset
+struct sim_stats {
+	uint32_t bus_us;       // time the bus was busy
+	uint16_t transactions; // START to STOP
+	uint16_t starts;       // START and repeated START conditions
+	uint16_t stops;
+	uint16_t bytes;        // bytes on the bus, address bytes included
+};
+
+// Power up a chip: time registers cleared, control registers at their
+// reset values, 25.00C
+void sim_init(enum sim_chip chip);
+enum sim_chip sim_get_chip(void);
+
+// Bus frequency used for timing (default TWI_FREQ)
+void sim_set_bus_freq(uint32_t hz);
+
+// Bus transactions, as seen by the chip. address is the 7 bit address.
+// Write: the first byte sets the register pointer. Returns 0 on success,
+// 2 when the address is not acknowledged (same as twi_writeTo).
+// Read: returns the number of bytes read, 0 when not acknowledged.
+uint8_t sim_bus_write(uint8_t address, const uint8_t* data, uint8_t len, uint8_t sendStop);
+uint8_t sim_bus_read(uint8_t address, uint8_t* data, uint8_t len, uint8_t sendStop);
+
+// Simulated time
+uint64_t sim_now_us(void);
+void sim_advance_us(uint32_t us);
+
+// Called on every falling edge of the INT/SQW (DS3231) or SQW/OUT (DS1307)
+// pin: the 1Hz square wave, or an alarm interrupt on the DS3231
+void sim_set_pin_handler(void (*handler)(void));
+
+// Chip temperature in 0.25C steps, picked up by the next conversion
+void sim_set_temp(int16_t quarters);
+
+// Direct register access, bypassing the bus (setting up a test)
+uint8_t sim_peek(uint8_t reg);
+void sim_poke(uint8_t reg, uint8_t value);
+
+void sim_stats_reset(void);
+void sim_stats_get(struct sim_stats* stats);
+
+// Complete queued twi_submit transactions (twi-sim.c): stands in for the
+// TWI interrupt, which would run them in the background
+void twi_sim_poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
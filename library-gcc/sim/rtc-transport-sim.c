@@ -0,0 +1,46 @@
+/*
+ * DS RTC Library: host simulator for the DS1307 and DS3231
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+// Transport backend talking to the simulated chip directly, without twi.c
+
+#include "../rtc-transport.h"
+#include "rtc-sim.h"
+
+uint8_t rtc_sim_read(uint8_t address, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+	if (sim_bus_write(address, &reg, 1, 0) != 0) return 0;
+	return sim_bus_read(address, buf, len, 1);
+}
+
+uint8_t rtc_sim_write(uint8_t address, uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+	uint8_t data[1 + 255];
+
+	data[0] = reg;
+	for (uint8_t i = 0; i < len; i++)
+		data[i + 1] = buf[i];
+
+	return sim_bus_write(address, data, len + 1, 1);
+}
+
+// queued in twi-sim.c, run by twi_sim_poll
+bool rtc_sim_submit(twi_xfer_t* xfer)
+{
+	return twi_submit(xfer) == 0;
+}
+
+#ifdef RTC_TRANSPORT_TABLE
+const struct rtc_transport rtc_transport_sim = { rtc_sim_read, rtc_sim_write, rtc_sim_submit };
+#endif
@@ -0,0 +1,150 @@
+/*
+ * DS RTC Library: host simulator for the DS1307 and DS3231
+ * (C) 2011 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * twi-lowlevel.c for the host: the same interface, with transactions going
+ * to the simulated chip instead of the TWI hardware. twi.c and rtc.c build
+ * on top of it unchanged.
+ */
+
+#include <stddef.h>
+
+#include "../twi-lowlevel.h"
+#include "rtc-sim.h"
+
+static twi_xfer_t* twi_queueHead;
+static twi_xfer_t* twi_queueTail;
+
+void twi_init(void)
+{
+}
+
+void twi_setAddress(uint8_t address)
+{
+  (void)address;
+}
+
+uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
+{
+  if(0 == length){
+    return 0;
+  }
+
+  // blocking transfers wait for the queue to drain, as on the hardware
+  twi_sim_poll();
+
+  return sim_bus_read(address, data, length, sendStop);
+}
+
+uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait, uint8_t sendStop)
+{
+  (void)wait;
+
+#ifndef TWI_MASTER_ONLY
+  // ensure data will fit into buffer
+  if(TWI_BUFFER_LENGTH < length){
+    return 1;
+  }
+#endif
+
+  twi_sim_poll();
+
+  return sim_bus_write(address, data, length, sendStop);
+}
+
+#ifndef TWI_MASTER_ONLY
+// there is no master to address the slave
+uint8_t twi_transmit(uint8_t* data, uint8_t length)
+{
+  (void)data;
+  (void)length;
+  return 2;
+}
+
+void twi_attachSlaveRxEvent( void (*function)(uint8_t*, int) )
+{
+  (void)function;
+}
+
+void twi_attachSlaveTxEvent( void (*function)(void) )
+{
+  (void)function;
+}
+#endif
+
+void twi_reply(uint8_t ack)
+{
+  (void)ack;
+}
+
+void twi_stop(void)
+{
+}
+
+void twi_repStart(void)
+{
+}
+
+void twi_releaseBus(void)
+{
+}
+
+uint8_t twi_submit(twi_xfer_t* x)
+{
+  if(0 == x->txLength && 0 == x->rxLength){
+    return 1;
+  }
+
+  x->status = TWI_XFER_PENDING;
+  x->next = NULL;
+
+  if(twi_queueTail){
+    twi_queueTail->next = x;
+  }else{
+    twi_queueHead = x;
+  }
+  twi_queueTail = x;
+
+  return 0;
+}
+
+// Run the queued transactions in order. Callbacks may queue more, which are
+// run as well.
+void twi_sim_poll(void)
+{
+  twi_xfer_t* x;
+
+  while((x = twi_queueHead)){
+    uint8_t ok = 1;
+
+    twi_queueHead = x->next;
+    if(!twi_queueHead){
+      twi_queueTail = NULL;
+    }
+
+    if(x->txLength){
+      // repeated start when a read follows
+      ok = 0 == sim_bus_write(x->address, x->txData, x->txLength, 0 == x->rxLength);
+    }
+    if(ok && x->rxLength){
+      ok = x->rxLength == sim_bus_read(x->address, x->rxData, x->rxLength, 1);
+    }
+
+    x->status = ok ? TWI_XFER_DONE : TWI_XFER_ERROR;
+    if(x->callback){
+      x->callback(x);
+    }
+  }
+}
@@ -0,0 +1,348 @@
+/*
+ * Wire RTC Library: host simulator for the DS1307 and DS3231
+ * (C) 2011-2013 Akafugu Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Runs the Arduino library against both simulated chips and prints the bus
+ * time each call costs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <Arduino.h>
+#include "WireRtcLib.h"
+#include "WireRtcTemp.h"
+
+static sim_stats s_stats;
+
+#define MEASURE(call) do { \
+		sim_stats_reset(); \
+		call; \
+		sim_stats_get(&s_stats); \
+		report(#call); \
+	} while (0)
+
+static void report(const char* call)
+{
+	printf("  %-40s %7lu us %4u tx %5u bytes\n", call,
+		(unsigned long)s_stats.bus_us, s_stats.transactions, s_stats.bytes);
+}
+
+static void print_time(const char* label, WireRtcLib::tm* t)
+{
+	printf("  %-40s %04d-%02d-%02d %02d:%02d:%02d wday %d\n", label,
+		2000 + t->year, t->mon, t->mday, t->hour, t->min, t->sec, t->wday);
+}
+
+static int s_temp_calls;
+
+static void temp_done(int8_t i, uint8_t f)
+{
+	(void)i;
+	(void)f;
+	s_temp_calls++;
+}
+
+// a conversion polled from a loop() that comes round every 10ms
+template<class Rtc>
+static int temp_demo(Rtc& rtc)
+{
+	int loops = 0;
+
+	rtc.startTempConversion(temp_done);
+	do {
+		delay(10);
+		loops++;
+	} while (rtc.pollTempConversion() != WireRtcLib::TEMP_READY);
+
+	return loops;
+}
+
+// ten minutes of a temperature that rises by a quarter degree a minute,
+// polled every second
+static int temp_log_demo(WireRtcTemp& log)
+{
+	int samples = 0;
+
+	log.begin();
+	for (int secs = 0; secs < 600; secs++) {
+		sim_set_temp(4 * 20 + secs / 60);
+		delay(1000);
+		if (log.poll()) samples++;
+	}
+	return samples;
+}
+
+static void print_temp(const char* label, int16_t q)
+{
+	int8_t i;
+	uint8_t f;
+
+	WireRtcTemp::split(q, &i, &f);
+	printf(" %s %d.%02u", label, i, f);
+}
+
+static volatile int s_alarm_calls;
+
+static void alarm_handler(void)
+{
+	s_alarm_calls++;
+}
+
+// alarms reported by checkAlarm, polled every second
+template<class Rtc>
+static int count_alarms(Rtc& rtc, uint32_t secs)
+{
+	int n = 0;
+
+	while (secs--) {
+		sim_advance_us(1000000);
+		if (rtc.checkAlarm()) n++;
+	}
+	return n;
+}
+
+static char s_alarm_dates[40];
+
+// the date as the chip has it when the handler runs
+static void date_handler(void)
+{
+	size_t n = strlen(s_alarm_dates);
+
+	snprintf(s_alarm_dates + n, sizeof(s_alarm_dates) - n, " %02x-%02x",
+		sim_peek(5) & 0x1F, sim_peek(4));
+}
+
+// the monthly alarm by interrupt alone, with nothing polling
+template<class Rtc>
+static void monthly_int_demo(Rtc& rtc)
+{
+	// Tuesday 2024-01-30 23:59:50, two months on
+	WireRtcLib::tm set = { 50, 59, 23, 30, 1, 24, 3, false, 0 };
+	WireRtcLib::tm now = *rtc.getTime();
+
+	rtc.setTime(&set);
+	rtc.setAlarmMode(WireRtcLib::ALARM_MONTHLY, 31, 0, 0, 5);
+	s_alarm_dates[0] = 0;
+	rtc.enableAlarmInterrupt(2, date_handler);
+	for (uint32_t secs = 0; secs < 62 * 86400UL; secs++)
+		sim_advance_us(1000000);
+	rtc.disableAlarmInterrupt();
+	rtc.setTime(&now);
+	printf("  %-40s%s\n", "31st 00:00:05, interrupt only", s_alarm_dates);
+}
+
+template<class Rtc>
+static void alarm_modes_demo(Rtc& rtc, sim_chip chip)
+{
+	// Wednesday 2024-02-28 23:59:50
+	WireRtcLib::tm set = { 50, 59, 23, 28, 2, 24, 3, false, 0 };
+
+	rtc.setTime(&set);
+	rtc.setAlarmMode(WireRtcLib::ALARM_EVERY_MINUTE, 0, 0, 0, 30);
+	printf("  %-40s %d in 3min\n", "every minute at :30", count_alarms(rtc, 180));
+
+	rtc.setTime(&set);
+	rtc.setAlarmMode(WireRtcLib::ALARM_WEEKLY, 4, 0, 0, 5);
+	printf("  %-40s %d in 1min\n", "Thursdays 00:00:05", count_alarms(rtc, 60));
+
+	rtc.setTime(&set);
+	rtc.setAlarmMode(WireRtcLib::ALARM_MONTHLY, 29, 0, 0, 5);
+	printf("  %-40s %d in 1min\n", "29th 00:00:05 (leap year)", count_alarms(rtc, 60));
+
+	// the DS3231 holds INT/SQW low until checkAlarm clears the flag
+	if (chip == SIM_DS1307) monthly_int_demo(rtc);
+	rtc.setAlarm_s(0, 0, 20);
+}
+
+template<class Rtc>
+static void run(Rtc& rtc, sim_chip chip)
+{
+	WireRtcLib::tm set = { 50, 59, 23, 28, 2, 24, 4, false, 0 };
+	WireRtcLib::tm* t;
+	uint8_t hour, min, sec;
+	int8_t ti;
+	uint8_t tf;
+	bool alarm;
+	int loops;
+	WireRtcLib::config config;
+
+	printf("%s\n", chip == SIM_DS1307 ? "DS1307" : "DS3231");
+
+	sim_init(chip);
+	Wire.begin();
+
+	MEASURE(rtc.begin());
+	printf("  %-40s %s\n", "chip", rtc.isDS1307() ? "DS1307" : "DS3231");
+
+	MEASURE(rtc.setTime(&set));
+	MEASURE(t = rtc.getTime());
+	print_time("time", t);
+	MEASURE(rtc.getTime_s(&hour, &min, &sec));
+	MEASURE(t = rtc.getFields(WireRtcLib::FIELD_SEC));
+	MEASURE(t = rtc.getFields(WireRtcLib::FIELD_DATE | WireRtcLib::FIELD_12H));
+	print_time("fields", t);
+
+	sim_advance_us(12000000);
+	MEASURE(t = rtc.getTime());
+	print_time("time, 12s later", t);
+
+	rtc.beginUpdate();
+	MEASURE(rtc.SQWSetFreq(WireRtcLib::FREQ_1));
+	MEASURE(rtc.SQWEnable(true));
+	MEASURE(rtc.endUpdate());
+
+	// the same configuration again costs nothing; the changes go in one write
+	rtc.getConfig(&config);
+	MEASURE(rtc.configure(config));
+	config.osc32kHz = true;
+	config.aging = -3;
+	MEASURE(rtc.configure(config));
+	rtc.reloadShadow();
+	rtc.getConfig(&config);
+	printf("  %-40s sqw %d freq %d 32kHz %d aging %d\n", "configuration, reloaded",
+		config.sqw, config.freq, config.osc32kHz, config.aging);
+
+	MEASURE(rtc.setAlarm_s(0, 0, 20));
+	sim_advance_us(18000000);
+	MEASURE(alarm = rtc.checkAlarm());
+	printf("  %-40s %s\n", "alarm at 00:00:20", alarm ? "fired" : "not fired");
+
+	// a poll that misses the matching second still reports the alarm, once
+	rtc.getTime_s(&hour, &min, &sec);
+	rtc.setAlarm_s(hour, min + (sec + 2) / 60, (sec + 2) % 60);
+	sim_advance_us(5000000);
+	MEASURE(alarm = rtc.checkAlarm());
+	printf("  %-40s %s\n", "alarm, poll 3s late", alarm ? "fired" : "not fired");
+	MEASURE(alarm = rtc.checkAlarm());
+	printf("  %-40s %s\n", "polled again", alarm ? "fired" : "not fired");
+
+	// the same alarm, delivered by interrupt instead of polling
+	s_alarm_calls = 0;
+	MEASURE(rtc.enableAlarmInterrupt(2, alarm_handler));
+	rtc.getTime_s(&hour, &min, &sec);
+	rtc.setAlarm_s(hour, min + (sec + 5) / 60, (sec + 5) % 60);
+	sim_advance_us(3000000);
+	MEASURE(alarm = rtc.checkAlarm());
+	sim_advance_us(3000000);
+	MEASURE(alarm = rtc.checkAlarm());
+	printf("  %-40s %s, handler called %d times\n", "alarm interrupt",
+		alarm ? "fired" : "not fired", s_alarm_calls);
+	MEASURE(alarm = rtc.checkAlarm());
+	rtc.disableAlarmInterrupt();
+
+	// DS3231: the square wave's edges aren't alarms
+	if (chip == SIM_DS3231) {
+		s_alarm_calls = 0;
+		rtc.enableAlarmInterrupt(2, alarm_handler);
+		MEASURE(rtc.SQWEnable(true));
+		sim_advance_us(3000000);
+		printf("  %-40s handler called %d times\n", "square wave, 3s", s_alarm_calls);
+		rtc.SQWEnable(false);
+	}
+
+	MEASURE(rtc.setAlarmMode(WireRtcLib::ALARM_WEEKLY, 1, 6, 0, 0));
+	MEASURE(rtc.getAlarmMode(0));
+	alarm_modes_demo(rtc, chip);
+
+	if (chip == SIM_DS3231) {
+		sim_set_temp(4 * 31 + 1);
+		MEASURE(rtc.forceTempConversion(1));
+		MEASURE(rtc.getTemp(&ti, &tf));
+		printf("  %-40s %d.%02u C\n", "temperature", ti, tf);
+
+		sim_set_temp(4 * 22 + 3);
+		s_temp_calls = 0;
+		MEASURE(loops = temp_demo(rtc));
+		MEASURE(rtc.getTempResult(&ti, &tf));
+		printf("  %-40s %d.%02u C after %d loops, callback %d\n", "temperature, polled",
+			ti, tf, loops, s_temp_calls);
+
+		WireRtcTemp log(rtc);
+		WireRtcTemp::stats stats;
+		MEASURE(loops = temp_log_demo(log));
+		MEASURE(log.getStats(&stats));
+		printf("  %-40s %d samples, %u kept:", "temperature log, 10min", loops, stats.count);
+		print_temp("last", stats.last);
+		print_temp("min", stats.min);
+		print_temp("max", stats.max);
+		print_temp("mean", stats.mean);
+		print_temp("ewma", stats.ewma);
+		printf("\n");
+	}
+
+	MEASURE(rtc.enableSoftClock(2, 0));
+	MEASURE(t = rtc.getTime());
+	sim_advance_us(5000000);
+	MEASURE(t = rtc.getTime());
+	print_time("soft clock, 5s later", t);
+	rtc.disableSoftClock();
+
+	// the square wave moved off 1Hz under the soft clock takes it along
+	rtc.setTime(&set);
+	rtc.enableSoftClock(2, 0);
+	MEASURE(rtc.SQWSetFreq(WireRtcLib::FREQ_1024));
+	sim_advance_us(10000000);
+	print_time("square wave at 1kHz, 10s later", rtc.getTime());
+
+	// 2024-02-28 23:59:50, then a day later
+	time_t epoch;
+	MEASURE(rtc.setEpoch(1709164790UL));
+	MEASURE(epoch = rtc.getEpoch());
+	print_time("epoch", rtc.getTime());
+	rtc.setEpoch(epoch + 86400);
+	print_time("a day later", rtc.getTime());
+
+	// 23:59:50: drift corrections write only what changed
+	WireRtcLib::tm adjust = *rtc.getTime();
+	adjust.sec -= 5;
+	MEASURE(rtc.adjustTime(&adjust));
+	adjust.min -= 1;
+	MEASURE(rtc.adjustTime(&adjust));
+	MEASURE(rtc.adjustTime(&adjust));
+	print_time("adjusted by -1:05", rtc.getTime());
+
+	// 10:05:00 read back an hour later off the soft clock, then set 2s back:
+	// the registers weren't read since, so the whole time is written
+	rtc.setTime_s(10, 5, 0);
+	rtc.enableSoftClock(2, 0);
+	rtc.getTime();
+	sim_advance_us(3602000000UL);
+	adjust = *rtc.getTime();
+	adjust.sec -= 2;
+	MEASURE(rtc.adjustTime(&adjust));
+	rtc.disableSoftClock();
+	print_time("adjusted by -0:02 on the soft clock", rtc.getTime());
+}
+
+int main(void)
+{
+	WireRtcLib autodetect;
+	WireRtc<Ds1307> ds1307;
+	WireRtc<Ds3231> ds3231;
+
+	printf("TWI_FREQ %ld Hz\n", (long)TWI_FREQ);
+	printf("WireRtcLib, autodetect\n");
+	run(autodetect, SIM_DS1307);
+	{
+		WireRtcLib again;
+		run(again, SIM_DS3231);
+	}
+	printf("WireRtc<Ds1307>\n");
+	run(ds1307, SIM_DS1307);
+	printf("WireRtc<Ds3231>\n");
+	run(ds3231, SIM_DS3231);
+	return 0;
+}
@@ -77,6 +77,11 @@ void main(void)
 		uartSendString("DS3231\n");
 
 	rtc_set_alarm_s(12, 1, 0);
+	// INT/SQW (DS3231) or SQW/OUT (DS1307) on INT0. DS3231: the alarm pulls
+	// INT0 low and rtc_check_alarm stays off the bus until then. DS1307: the
+	// 1Hz square wave is turned on and the alarm is counted down on its
+	// edges, re-read from the chip about once an hour.
+	rtc_alarm_int_enable(NULL);
 	
 	rtc_get_alarm_s(&hour, &min, &sec);
 
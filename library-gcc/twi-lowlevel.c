@@ -36,23 +36,37 @@
 
 static volatile uint8_t twi_state;
 static uint8_t twi_slarw;
+static volatile uint8_t twi_sendStop;   // should the transaction end with a stop
+static volatile uint8_t twi_inRepStart; // in the middle of a repeated start
+static volatile uint8_t twi_blocking;   // twi_readFrom/twi_writeTo hasn't taken its result yet
 
+#ifndef TWI_MASTER_ONLY
 static void (*twi_onSlaveTransmit)(void);
 static void (*twi_onSlaveReceive)(uint8_t*, int);
 
 static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
+#endif
+static uint8_t* twi_masterData; // twi_masterBuffer, or the caller's buffer
 static volatile uint8_t twi_masterBufferIndex;
 static uint8_t twi_masterBufferLength;
 
+static twi_xfer_t* volatile twi_current;    // queued transaction on the bus
+static twi_xfer_t* volatile twi_queueHead;  // queued transactions waiting for the bus
+static twi_xfer_t* twi_queueTail;
+
+#ifndef TWI_MASTER_ONLY
 static uint8_t twi_txBuffer[TWI_BUFFER_LENGTH];
 static volatile uint8_t twi_txBufferIndex;
 static volatile uint8_t twi_txBufferLength;
 
 static uint8_t twi_rxBuffer[TWI_BUFFER_LENGTH];
 static volatile uint8_t twi_rxBufferIndex;
+#endif
 
 static volatile uint8_t twi_error;
 
+static void twi_xferStart(void);
+
 /* 
  * Function twi_init
  * Desc     readys twi pins and sets twi bitrate
@@ -63,6 +77,9 @@ void twi_init(void)
 {
   // initialize state
   twi_state = TWI_READY;
+  twi_sendStop = 1;
+  twi_inRepStart = 0;
+  twi_blocking = 0;
 
   #if defined(__AVR_ATmega168__) || defined(__AVR_ATmega8__) || defined(__AVR_ATmega328P__)
     // activate internal pull-ups for twi
@@ -102,33 +119,79 @@ void twi_setAddress(uint8_t address)
   TWAR = address << 1;
 }
 
+/* 
+ * Function twi_claim
+ * Desc     waits until the bus is free and becomes its master
+ *          the check and the claim are one step with interrupts off, so a
+ *          twi_submit from an interrupt can't start a transaction in between
+ *          a queued transaction waits behind a repeated start we hold
+ *          queued transactions are held until twi_release: starting one
+ *          resets the index and error the caller takes its result from
+ * Input    state: TWI_MRX or TWI_MTX
+ * Output   none
+ */
+static void twi_claim(uint8_t state)
+{
+  uint8_t sreg;
+
+  for(;;){
+    sreg = SREG;
+    cli();
+    if(TWI_READY == twi_state && !twi_current && (!twi_queueHead || twi_inRepStart)){
+      twi_state = state;
+      twi_blocking = 1;
+      SREG = sreg;
+      return;
+    }
+    SREG = sreg;
+  }
+}
+
+/* 
+ * Function twi_release
+ * Desc     lets queued transactions run again once the caller of
+ *          twi_claim has its result, and starts one if the bus is free
+ * Input    none
+ * Output   none
+ */
+static void twi_release(void)
+{
+  uint8_t sreg;
+
+  sreg = SREG;
+  cli();
+  twi_blocking = 0;
+  if(twi_queueHead && !twi_current && !twi_inRepStart && TWI_READY == twi_state){
+    twi_xferStart();
+  }
+  SREG = sreg;
+}
+
 /* 
  * Function twi_readFrom
  * Desc     attempts to become twi bus master and read a
  *          series of bytes from a device on the bus
+ *          the interrupt stores the bytes straight into data
  * Input    address: 7bit i2c device address
  *          data: pointer to byte array
  *          length: number of bytes to read into array
+ *          sendStop: boolean indicating whether to send a stop at the end
  * Output   number of bytes read
  */
-uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
+uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
 {
-  uint8_t i;
-
-  // ensure data will fit into buffer
-  if(TWI_BUFFER_LENGTH < length){
+  if(0 == length){
     return 0;
   }
 
   // wait until twi is ready, become master receiver
-  while(TWI_READY != twi_state){
-    continue;
-  }
-  twi_state = TWI_MRX;
+  twi_claim(TWI_MRX);
+  twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterData = data;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length-1;  // This is not intuitive, read on...
   // On receive, the previously configured ACK/NACK setting is transmitted in
@@ -141,8 +204,20 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
   twi_slarw = TW_READ;
   twi_slarw |= address << 1;
 
-  // send start condition
-  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+  if(twi_inRepStart){
+    // the previous transaction ended with a repeated start instead of a stop,
+    // so the start is already on the bus and the hardware is waiting for the
+    // address. Leave the repeated start state before enabling the interrupt,
+    // and don't request another start.
+    twi_inRepStart = 0;
+    do {
+      TWDR = twi_slarw;
+    } while(TWCR & _BV(TWWC));
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+  }else{
+    // send start condition
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+  }
 
   // wait for read operation to complete
   while(TWI_MRX == twi_state){
@@ -152,11 +227,7 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
   if (twi_masterBufferIndex < length)
     length = twi_masterBufferIndex;
 
-  // copy twi buffer to data
-  for(i = 0; i < length; ++i){
-    data[i] = twi_masterBuffer[i];
-  }
-	
+  twi_release();
   return length;
 }
 
@@ -164,30 +235,34 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length)
  * Function twi_writeTo
  * Desc     attempts to become twi bus master and write a
  *          series of bytes to a device on the bus
+ *          with TWI_MASTER_ONLY the interrupt sends straight from data,
+ *          which must stay valid until the write is done (see wait)
  * Input    address: 7bit i2c device address
  *          data: pointer to byte array
  *          length: number of bytes in array
  *          wait: boolean indicating to wait for write or not
+ *          sendStop: boolean indicating whether or not to send a stop at the end
  * Output   0 .. success
  *          1 .. length to long for buffer
  *          2 .. address send, NACK received
  *          3 .. data send, NACK received
  *          4 .. other twi error (lost bus arbitration, bus error, ..)
  */
-uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait)
+uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait, uint8_t sendStop)
 {
+  uint8_t ret;
+#ifndef TWI_MASTER_ONLY
   uint8_t i;
 
   // ensure data will fit into buffer
   if(TWI_BUFFER_LENGTH < length){
     return 1;
   }
+#endif
 
   // wait until twi is ready, become master transmitter
-  while(TWI_READY != twi_state){
-    continue;
-  }
-  twi_state = TWI_MTX;
+  twi_claim(TWI_MTX);
+  twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
@@ -195,17 +270,34 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length;
   
+#ifdef TWI_MASTER_ONLY
+  twi_masterData = data;
+#else
   // copy data to twi buffer
+  twi_masterData = twi_masterBuffer;
   for(i = 0; i < length; ++i){
     twi_masterBuffer[i] = data[i];
   }
+#endif
   
   // build sla+w, slave device address + w bit
   twi_slarw = TW_WRITE;
   twi_slarw |= address << 1;
   
-  // send start condition
-  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+  if(twi_inRepStart){
+    // the previous transaction ended with a repeated start instead of a stop,
+    // so the start is already on the bus and the hardware is waiting for the
+    // address. Leave the repeated start state before enabling the interrupt,
+    // and don't request another start.
+    twi_inRepStart = 0;
+    do {
+      TWDR = twi_slarw;
+    } while(TWCR & _BV(TWWC));
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+  }else{
+    // send start condition
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+  }
 
   // wait for write operation to complete
   while(wait && (TWI_MTX == twi_state)){
@@ -213,15 +305,19 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   }
   
   if (twi_error == 0xFF)
-    return 0;	// success
+    ret = 0;	// success
   else if (twi_error == TW_MT_SLA_NACK)
-    return 2;	// error: address send, nack received
+    ret = 2;	// error: address send, nack received
   else if (twi_error == TW_MT_DATA_NACK)
-    return 3;	// error: data send, nack received
+    ret = 3;	// error: data send, nack received
   else
-    return 4;	// other twi error
+    ret = 4;	// other twi error
+
+  twi_release();
+  return ret;
 }
 
+#ifndef TWI_MASTER_ONLY
 /* 
  * Function twi_transmit
  * Desc     fills slave tx buffer with data
@@ -276,6 +372,7 @@ void twi_attachSlaveTxEvent( void (*function)(void) )
 {
   twi_onSlaveTransmit = function;
 }
+#endif
 
 /* 
  * Function twi_reply
@@ -314,6 +411,26 @@ void twi_stop(void)
   twi_state = TWI_READY;
 }
 
+/* 
+ * Function twi_repStart
+ * Desc     keeps bus master status by sending a repeated start
+ *          the next twi_readFrom/twi_writeTo continues from there
+ * Input    none
+ * Output   none
+ */
+void twi_repStart(void)
+{
+  // we're gonna send the start
+  twi_inRepStart = 1;
+  // generate the start, but don't enable the interrupt: it is handled when
+  // the next transaction is set up, at the point where it would normally
+  // issue the start itself
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+
+  // update twi state
+  twi_state = TWI_READY;
+}
+
 /* 
  * Function twi_releaseBus
  * Desc     releases bus control
@@ -329,6 +446,127 @@ void twi_releaseBus(void)
   twi_state = TWI_READY;
 }
 
+/* 
+ * Function twi_xferRead
+ * Desc     sets up the read part of a queued transaction
+ * Input    x: transaction
+ * Output   none
+ */
+static void twi_xferRead(twi_xfer_t* x)
+{
+  twi_state = TWI_MRX;
+  twi_masterData = x->rxData;
+  twi_masterBufferIndex = 0;
+  twi_masterBufferLength = x->rxLength-1; // see twi_readFrom
+  twi_slarw = TW_READ;
+  twi_slarw |= x->address << 1;
+}
+
+/* 
+ * Function twi_xferStart
+ * Desc     takes the next transaction off the queue and sends a start
+ *          must be called with interrupts disabled, bus ready
+ * Input    none
+ * Output   none
+ */
+static void twi_xferStart(void)
+{
+  twi_xfer_t* x = twi_queueHead;
+
+  twi_queueHead = x->next;
+  if(!twi_queueHead){
+    twi_queueTail = 0;
+  }
+  twi_current = x;
+
+  twi_sendStop = 1;
+  // reset error state (0xFF.. no error occured)
+  twi_error = 0xFF;
+
+  if(x->txLength){
+    twi_state = TWI_MTX;
+    twi_masterData = x->txData;
+    twi_masterBufferIndex = 0;
+    twi_masterBufferLength = x->txLength;
+    twi_slarw = TW_WRITE;
+    twi_slarw |= x->address << 1;
+  }else{
+    twi_xferRead(x);
+  }
+
+  // send start condition
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+}
+
+/* 
+ * Function twi_xferComplete
+ * Desc     reports the finished queued transaction to its owner
+ *          and starts the next one
+ *          called from the TWI interrupt once the bus is ready
+ * Input    none
+ * Output   none
+ */
+static void twi_xferComplete(void)
+{
+  twi_xfer_t* x = twi_current;
+
+  if(x){
+    twi_current = 0;
+    if(0xFF == twi_error && twi_masterBufferIndex >= x->rxLength){
+      x->status = TWI_XFER_DONE;
+    }else{
+      x->status = TWI_XFER_ERROR;
+    }
+    if(x->callback){
+      x->callback(x);
+    }
+  }
+
+  // the callback may already have started a new transaction
+  if(twi_queueHead && !twi_current && !twi_inRepStart && !twi_blocking && TWI_READY == twi_state){
+    twi_xferStart();
+  }
+}
+
+/* 
+ * Function twi_submit
+ * Desc     queues a master transaction without waiting for it
+ *          transactions run back to back from the TWI interrupt
+ *          a blocking twi_readFrom/twi_writeTo waits for the queue to drain,
+ *          and the queue waits for it to take its result
+ * Input    x: transaction descriptor, owned by the caller until done
+ * Output   0 .. queued
+ *          1 .. nothing to transfer
+ */
+uint8_t twi_submit(twi_xfer_t* x)
+{
+  uint8_t sreg;
+
+  if(0 == x->txLength && 0 == x->rxLength){
+    return 1;
+  }
+
+  x->status = TWI_XFER_PENDING;
+  x->next = 0;
+
+  // the queue is shared with the TWI interrupt (callbacks may submit too)
+  sreg = SREG;
+  cli();
+  if(twi_queueTail){
+    twi_queueTail->next = x;
+  }else{
+    twi_queueHead = x;
+  }
+  twi_queueTail = x;
+
+  if(!twi_current && !twi_inRepStart && !twi_blocking && TWI_READY == twi_state){
+    twi_xferStart();
+  }
+  SREG = sreg;
+
+  return 0;
+}
+
 SIGNAL(TWI_vect)
 {
   switch(TW_STATUS){
@@ -346,10 +584,16 @@ SIGNAL(TWI_vect)
       // if there is data to send, send it, otherwise stop 
       if(twi_masterBufferIndex < twi_masterBufferLength){
         // copy data to output register and ack
-        TWDR = twi_masterBuffer[twi_masterBufferIndex++];
+        TWDR = twi_masterData[twi_masterBufferIndex++];
         twi_reply(1);
-      }else{
+      }else if(twi_current && twi_current->rxLength){
+        // queued write-then-read: turn around with a repeated start
+        twi_xferRead(twi_current);
+        TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+      }else if(twi_sendStop){
         twi_stop();
+      }else{
+        twi_repStart();
       }
       break;
     case TW_MT_SLA_NACK:  // address sent, nack received
@@ -368,7 +612,7 @@ SIGNAL(TWI_vect)
     // Master Receiver
     case TW_MR_DATA_ACK: // data received, ack sent
       // put byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterData[twi_masterBufferIndex++] = TWDR;
     case TW_MR_SLA_ACK:  // address sent, ack received
       // ack if more bytes are expected, otherwise nack
       if(twi_masterBufferIndex < twi_masterBufferLength){
@@ -379,12 +623,19 @@ SIGNAL(TWI_vect)
       break;
     case TW_MR_DATA_NACK: // data received, nack sent
       // put final byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterData[twi_masterBufferIndex++] = TWDR;
+      if(twi_sendStop){
+        twi_stop();
+      }else{
+        twi_repStart();
+      }
+      break;
     case TW_MR_SLA_NACK: // address sent, nack received
       twi_stop();
       break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
 
+#ifndef TWI_MASTER_ONLY
     // Slave Receiver
     case TW_SR_SLA_ACK:   // addressed, returned ack
     case TW_SR_GCALL_ACK: // addressed generally, returned ack
@@ -463,6 +714,7 @@ SIGNAL(TWI_vect)
       // leave slave receiver state
       twi_state = TWI_READY;
       break;
+#endif
 
     // All
     case TW_NO_INFO:   // no state information
@@ -472,5 +724,10 @@ SIGNAL(TWI_vect)
       twi_stop();
       break;
   }
+
+  // bus released: finish the queued transaction and start the next one
+  if(TWI_READY == twi_state && (twi_current || twi_queueHead)){
+    twi_xferComplete();
+  }
 }
 
@@ -32,6 +32,11 @@
 #define TWI_FREQ 100000L
 #endif
 
+// Define TWI_MASTER_ONLY to build without slave support: the slave
+// buffers and callbacks are dropped, and master writes are sent straight
+// from the caller's buffer
+//#define TWI_MASTER_ONLY
+
 #ifndef TWI_BUFFER_LENGTH
 #define TWI_BUFFER_LENGTH 32
 #endif
@@ -42,16 +47,41 @@
 #define TWI_SRX   3
 #define TWI_STX   4
 
+// status of a queued transaction
+#define TWI_XFER_DONE    0
+#define TWI_XFER_PENDING 1
+#define TWI_XFER_ERROR   2
+
+// Queued (non-blocking) master transaction: writes txLength bytes, then reads
+// rxLength bytes after a repeated start. Either part may be empty.
+// The descriptor and both buffers are owned by the caller and must stay
+// valid until status leaves TWI_XFER_PENDING.
+typedef struct twi_xfer twi_xfer_t;
+struct twi_xfer {
+  uint8_t address;                // 7bit i2c device address
+  uint8_t* txData;
+  uint8_t txLength;
+  uint8_t* rxData;
+  uint8_t rxLength;
+  void (*callback)(twi_xfer_t*);  // called from the TWI interrupt when done (may be 0)
+  volatile uint8_t status;        // TWI_XFER_*
+  twi_xfer_t* next;
+};
+
 void twi_init(void);
 void twi_setAddress(uint8_t);
-uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t);
-uint8_t twi_writeTo(uint8_t, uint8_t*, uint8_t, uint8_t);
+uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
+uint8_t twi_writeTo(uint8_t, uint8_t*, uint8_t, uint8_t, uint8_t);
+#ifndef TWI_MASTER_ONLY
 uint8_t twi_transmit(uint8_t*, uint8_t);
 void twi_attachSlaveRxEvent( void (*)(uint8_t*, int) );
 void twi_attachSlaveTxEvent( void (*)(void) );
+#endif
 void twi_reply(uint8_t);
 void twi_stop(void);
+void twi_repStart(void);
 void twi_releaseBus(void);
+uint8_t twi_submit(twi_xfer_t*);
 
 #endif
 
@@ -25,21 +25,31 @@
 #include "twi.h"
 
 // local variables
+#ifdef TWI_MASTER_ONLY
+// a master only ever has one transfer going, so transmit and receive share
+// one buffer: starting a transmission discards unread received bytes
+uint8_t twiBuffer[BUFFER_LENGTH];
+#define rxBuffer twiBuffer
+#define txBuffer twiBuffer
+#else
 uint8_t rxBuffer[BUFFER_LENGTH];
+uint8_t txBuffer[BUFFER_LENGTH];
+#endif
 uint8_t rxBufferIndex = 0;
 uint8_t rxBufferLength = 0;
 
 uint8_t txAddress = 0;
-uint8_t txBuffer[BUFFER_LENGTH];
 uint8_t txBufferIndex = 0;
 uint8_t txBufferLength = 0;
 
 uint8_t transmitting = 0;
+#ifndef TWI_MASTER_ONLY
 void (*user_onRequest)(void);
 void (*user_onReceive)(int);
 
 void onRequestService(void);
 void onReceiveService(uint8_t*, int);
+#endif
 
 void twi_init_master(void)
 {
@@ -52,6 +62,7 @@ void twi_init_master(void)
   twi_init();
 }
 
+#ifndef TWI_MASTER_ONLY
 void twi_init_slave(uint8_t address)
 {
   twi_setAddress(address);
@@ -59,6 +70,7 @@ void twi_init_slave(uint8_t address)
   twi_attachSlaveRxEvent(onReceiveService);
   twi_init_master();
 }
+#endif
 
 uint8_t twi_request_from(uint8_t address, uint8_t quantity)
 {
@@ -67,7 +79,7 @@ uint8_t twi_request_from(uint8_t address, uint8_t quantity)
     quantity = BUFFER_LENGTH;
   }
   // perform blocking read into buffer
-  uint8_t read = twi_readFrom(address, rxBuffer, quantity);
+  uint8_t read = twi_readFrom(address, rxBuffer, quantity, 1);
   // set rx buffer iterator vars
   rxBufferIndex = 0;
   rxBufferLength = read;
@@ -75,6 +87,14 @@ uint8_t twi_request_from(uint8_t address, uint8_t quantity)
   return read;
 }
 
+// reads straight into the caller's buffer, bypassing rxBuffer and
+// twi_receive(); there is no BUFFER_LENGTH limit on quantity
+uint8_t twi_request_into(uint8_t address, uint8_t* data, uint8_t quantity)
+{
+  // perform blocking read into data
+  return twi_readFrom(address, data, quantity, 1);
+}
+
 void twi_begin_transmission(uint8_t address)
 {
   // indicate that we are transmitting
@@ -84,12 +104,19 @@ void twi_begin_transmission(uint8_t address)
   // reset tx buffer iterator vars
   txBufferIndex = 0;
   txBufferLength = 0;
+#ifdef TWI_MASTER_ONLY
+  // the shared buffer is about to be overwritten
+  rxBufferIndex = 0;
+  rxBufferLength = 0;
+#endif
 }
 
-uint8_t twi_end_transmission(void)
+// sendStop: 0 keeps the bus with a repeated start, so that a following
+// twi_request_from() shares the same bus session
+uint8_t twi_end_transmission(uint8_t sendStop)
 {
   // transmit buffer (blocking)
-  int8_t ret = twi_writeTo(txAddress, txBuffer, txBufferLength, 1);
+  int8_t ret = twi_writeTo(txAddress, txBuffer, txBufferLength, 1, sendStop);
   // reset tx buffer iterator vars
   txBufferIndex = 0;
   txBufferLength = 0;
@@ -114,11 +141,14 @@ void twi_send_byte(uint8_t data)
     ++txBufferIndex;
     // update amount in buffer   
     txBufferLength = txBufferIndex;
-  }else{
+  }
+#ifndef TWI_MASTER_ONLY
+  else{
   // in slave send mode
     // reply to master
     twi_transmit(&data, 1);
   }
+#endif
 }
 
 // must be called in:
@@ -131,11 +161,14 @@ void twi_send(uint8_t* data, uint8_t quantity)
     for(uint8_t i = 0; i < quantity; ++i){
      twi_send_byte(data[i]);
     }
-  }else{
+  }
+#ifndef TWI_MASTER_ONLY
+  else{
   // in slave send mode
     // reply to master
     twi_transmit(data, quantity);
   }
+#endif
 }
 
 // must be called in:
@@ -172,6 +205,7 @@ uint8_t twi_receive(void)
   return value;
 }
 
+#ifndef TWI_MASTER_ONLY
 // behind the scenes function that is called when data is received
 void onReceiveService(uint8_t* inBytes, int numBytes)
 {
@@ -223,4 +257,4 @@ void twi_set_on_request( void (*function)(void) )
 {
   user_onRequest = function;
 }
-
+#endif
@@ -22,19 +22,34 @@
 
 #include <inttypes.h>
 
+#include "twi-lowlevel.h"
+
+#ifndef BUFFER_LENGTH
+#ifdef TWI_MASTER_ONLY
+// one shared buffer, sized to the largest RTC write:
+// register pointer + the 56 bytes of DS1307 SRAM
+#define BUFFER_LENGTH 57
+#else
 #define BUFFER_LENGTH 32
+#endif
+#endif
 
 void twi_init_master(void);
+#ifndef TWI_MASTER_ONLY
 void twi_init_slave(uint8_t);
+#endif
 void twi_begin_transmission(uint8_t);
-uint8_t twi_end_transmission(void);
+uint8_t twi_end_transmission(uint8_t);
 uint8_t twi_request_from(uint8_t, uint8_t);
+uint8_t twi_request_into(uint8_t, uint8_t*, uint8_t);
 void twi_send_byte(uint8_t);
 void twi_send(uint8_t*, uint8_t);
 void twi_send_char(char*);
 uint8_t twi_available(void);
 uint8_t twi_receive(void);
+#ifndef TWI_MASTER_ONLY
 void twi_set_on_receive( void (*)(int) );
 void twi_set_on_request( void (*)(void) );
+#endif
 
 #endif